@@ -5,6 +5,9 @@
       'cflags': [ '-Wall', '-Werror' ],
       'type': 'static_library',
       'include_dirs': [ 'include' ],
+      'direct_dependent_settings': {
+        'include_dirs': [ 'include' ],
+      },
       'sources': [
         'src/shim.h',
         'src/shim.cc',
@@ -0,0 +1,322 @@
+/*
+ * Copyright Joyent, Inc. and other Node contributors.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to permit
+ * persons to whom the Software is furnished to do so, subject to the
+ * following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN
+ * NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef NODE_SHIM_UNPACK_H
+#define NODE_SHIM_UNPACK_H
+
+#ifndef __cplusplus
+#error "shim-unpack.h is only available to C++ consumers"
+#endif
+
+#include "v8.h"
+#include "node.h"
+#include "node_buffer.h"
+
+#include "shim.h"
+
+/**
+ * \defgroup unpack Typed argument unpacking
+ * Header only argument unpacking for C++ consumers
+ *
+ * The conversion for each argument is picked at compile time from the
+ * template arguments, so there is no va_list and no switch on ::shim_type_t:
+ *
+ * ~~~~~~~~~~~~~~~{.cpp}
+ * int32_t fd;
+ * double timeout;
+ * shim_val_t* cb;
+ *
+ * if (!shim::unpack<int32_t, double, shim::js_function>(ctx, args,
+ *                                                        &fd, &timeout, &cb))
+ *   return FALSE;
+ * ~~~~~~~~~~~~~~~
+ *
+ * Like shim_unpack(), arguments past shim_args_length() are left untouched
+ * and a mismatch throws a TypeError and returns false.
+ * @{
+ */
+
+namespace shim {
+
+/** The unwrapped argument at idx, only valid below shim_args_length() */
+v8::Local<v8::Value> args_value(shim_args_t* args, size_t idx);
+
+/** Unpack a string argument into a shim_val_t* */
+struct js_string {};
+/** Unpack a function argument into a shim_val_t* */
+struct js_function {};
+
+/**
+ * Describes how a C type is checked and converted, `type` is what the
+ * destination pointer points to
+ */
+template <typename T>
+struct unpack_traits;
+
+template <>
+struct unpack_traits<bool> {
+  typedef bool type;
+  static inline const char* name() { return "SHIM_TYPE_BOOL"; }
+  static inline bool is(shim_args_t*, size_t, v8::Local<v8::Value> v) {
+    return v->IsBoolean();
+  }
+  static inline type get(shim_ctx_t*, shim_args_t*, size_t,
+    v8::Local<v8::Value> v) {
+    return v->BooleanValue();
+  }
+};
+
+template <>
+struct unpack_traits<int32_t> {
+  typedef int32_t type;
+  static inline const char* name() { return "SHIM_TYPE_INT32"; }
+  static inline bool is(shim_args_t*, size_t, v8::Local<v8::Value> v) {
+    return v->IsInt32();
+  }
+  static inline type get(shim_ctx_t*, shim_args_t*, size_t,
+    v8::Local<v8::Value> v) {
+    return v->Int32Value();
+  }
+};
+
+template <>
+struct unpack_traits<uint32_t> {
+  typedef uint32_t type;
+  static inline const char* name() { return "SHIM_TYPE_UINT32"; }
+  static inline bool is(shim_args_t*, size_t, v8::Local<v8::Value> v) {
+    return v->IsUint32();
+  }
+  static inline type get(shim_ctx_t*, shim_args_t*, size_t,
+    v8::Local<v8::Value> v) {
+    return v->Uint32Value();
+  }
+};
+
+template <>
+struct unpack_traits<int64_t> {
+  typedef int64_t type;
+  static inline const char* name() { return "SHIM_TYPE_INTEGER"; }
+  static inline bool is(shim_args_t*, size_t, v8::Local<v8::Value> v) {
+    return v->IsNumber();
+  }
+  static inline type get(shim_ctx_t*, shim_args_t*, size_t,
+    v8::Local<v8::Value> v) {
+    return v->IntegerValue();
+  }
+};
+
+template <>
+struct unpack_traits<double> {
+  typedef double type;
+  static inline const char* name() { return "SHIM_TYPE_NUMBER"; }
+  static inline bool is(shim_args_t*, size_t, v8::Local<v8::Value> v) {
+    return v->IsNumber();
+  }
+  static inline type get(shim_ctx_t*, shim_args_t*, size_t,
+    v8::Local<v8::Value> v) {
+    return v->NumberValue();
+  }
+};
+
+template <>
+struct unpack_traits<char*> {
+  typedef char* type;
+  static inline const char* name() { return "SHIM_TYPE_BUFFER"; }
+  static inline bool is(shim_args_t*, size_t, v8::Local<v8::Value> v) {
+    return node::Buffer::HasInstance(v);
+  }
+  static inline type get(shim_ctx_t*, shim_args_t*, size_t,
+    v8::Local<v8::Value> v) {
+    return node::Buffer::Data(v.As<v8::Object>());
+  }
+};
+
+template <>
+struct unpack_traits<void*> {
+  typedef void* type;
+  static inline const char* name() { return "SHIM_TYPE_EXTERNAL"; }
+#if NODE_VERSION_AT_LEAST(0, 11, 3)
+  static inline bool is(shim_args_t*, size_t, v8::Local<v8::Value> v) {
+    return v->IsExternal();
+  }
+  static inline type get(shim_ctx_t*, shim_args_t*, size_t,
+    v8::Local<v8::Value> v) {
+    return v.As<v8::External>()->Value();
+  }
+#else
+  /* externals are hidden inside an object before 0.11.3 */
+  static inline bool is(shim_args_t* args, size_t idx, v8::Local<v8::Value>) {
+    return shim_value_is(shim_args_get(args, idx), SHIM_TYPE_EXTERNAL);
+  }
+  static inline type get(shim_ctx_t* ctx, shim_args_t* args, size_t idx,
+    v8::Local<v8::Value>) {
+    return shim_external_value(ctx, shim_args_get(args, idx));
+  }
+#endif
+};
+
+template <>
+struct unpack_traits<shim_val_t*> {
+  typedef shim_val_t* type;
+  static inline const char* name() { return "SHIM_TYPE_UNKNOWN"; }
+  static inline bool is(shim_args_t*, size_t, v8::Local<v8::Value>) {
+    return true;
+  }
+  static inline type get(shim_ctx_t*, shim_args_t* args, size_t idx,
+    v8::Local<v8::Value>) {
+    return shim_args_get(args, idx);
+  }
+};
+
+template <>
+struct unpack_traits<js_string> {
+  typedef shim_val_t* type;
+  static inline const char* name() { return "SHIM_TYPE_STRING"; }
+  static inline bool is(shim_args_t*, size_t, v8::Local<v8::Value> v) {
+    return v->IsString();
+  }
+  static inline type get(shim_ctx_t*, shim_args_t* args, size_t idx,
+    v8::Local<v8::Value>) {
+    return shim_args_get(args, idx);
+  }
+};
+
+template <>
+struct unpack_traits<js_function> {
+  typedef shim_val_t* type;
+  static inline const char* name() { return "SHIM_TYPE_FUNCTION"; }
+  static inline bool is(shim_args_t*, size_t, v8::Local<v8::Value> v) {
+    return v->IsFunction();
+  }
+  static inline type get(shim_ctx_t*, shim_args_t* args, size_t idx,
+    v8::Local<v8::Value>) {
+    return shim_args_get(args, idx);
+  }
+};
+
+
+/** Unpack the argument at idx as T */
+template <typename T>
+inline bool
+unpack_one(shim_ctx_t* ctx, shim_args_t* args, size_t idx,
+  typename unpack_traits<T>::type* rval)
+{
+  if (idx >= shim_args_length(args))
+    return true;
+
+  v8::Local<v8::Value> v = args_value(args, idx);
+
+  if (!unpack_traits<T>::is(args, idx, v)) {
+    shim_throw_type_error(ctx, "Argument %d not of type %s",
+      static_cast<int>(idx), unpack_traits<T>::name());
+    return false;
+  }
+
+  *rval = unpack_traits<T>::get(ctx, args, idx, v);
+  return true;
+}
+
+template <typename A>
+inline bool
+unpack(shim_ctx_t* ctx, shim_args_t* args,
+  typename unpack_traits<A>::type* a)
+{
+  return unpack_one<A>(ctx, args, 0, a);
+}
+
+template <typename A, typename B>
+inline bool
+unpack(shim_ctx_t* ctx, shim_args_t* args,
+  typename unpack_traits<A>::type* a,
+  typename unpack_traits<B>::type* b)
+{
+  return unpack_one<A>(ctx, args, 0, a)
+    && unpack_one<B>(ctx, args, 1, b);
+}
+
+template <typename A, typename B, typename C>
+inline bool
+unpack(shim_ctx_t* ctx, shim_args_t* args,
+  typename unpack_traits<A>::type* a,
+  typename unpack_traits<B>::type* b,
+  typename unpack_traits<C>::type* c)
+{
+  return unpack_one<A>(ctx, args, 0, a)
+    && unpack_one<B>(ctx, args, 1, b)
+    && unpack_one<C>(ctx, args, 2, c);
+}
+
+template <typename A, typename B, typename C, typename D>
+inline bool
+unpack(shim_ctx_t* ctx, shim_args_t* args,
+  typename unpack_traits<A>::type* a,
+  typename unpack_traits<B>::type* b,
+  typename unpack_traits<C>::type* c,
+  typename unpack_traits<D>::type* d)
+{
+  return unpack_one<A>(ctx, args, 0, a)
+    && unpack_one<B>(ctx, args, 1, b)
+    && unpack_one<C>(ctx, args, 2, c)
+    && unpack_one<D>(ctx, args, 3, d);
+}
+
+template <typename A, typename B, typename C, typename D, typename E>
+inline bool
+unpack(shim_ctx_t* ctx, shim_args_t* args,
+  typename unpack_traits<A>::type* a,
+  typename unpack_traits<B>::type* b,
+  typename unpack_traits<C>::type* c,
+  typename unpack_traits<D>::type* d,
+  typename unpack_traits<E>::type* e)
+{
+  return unpack_one<A>(ctx, args, 0, a)
+    && unpack_one<B>(ctx, args, 1, b)
+    && unpack_one<C>(ctx, args, 2, c)
+    && unpack_one<D>(ctx, args, 3, d)
+    && unpack_one<E>(ctx, args, 4, e);
+}
+
+template <typename A, typename B, typename C, typename D, typename E,
+          typename F>
+inline bool
+unpack(shim_ctx_t* ctx, shim_args_t* args,
+  typename unpack_traits<A>::type* a,
+  typename unpack_traits<B>::type* b,
+  typename unpack_traits<C>::type* c,
+  typename unpack_traits<D>::type* d,
+  typename unpack_traits<E>::type* e,
+  typename unpack_traits<F>::type* f)
+{
+  return unpack_one<A>(ctx, args, 0, a)
+    && unpack_one<B>(ctx, args, 1, b)
+    && unpack_one<C>(ctx, args, 2, c)
+    && unpack_one<D>(ctx, args, 3, d)
+    && unpack_one<E>(ctx, args, 4, e)
+    && unpack_one<F>(ctx, args, 5, f);
+}
+
+} /* namespace shim */
+
+/**@}*/
+
+#endif
@@ -57,12 +57,15 @@ typedef enum shim_type {
   SHIM_TYPE_FUNCTION,     /**< v8::Function */
   SHIM_TYPE_STRING,       /**< v8::String */
   SHIM_TYPE_BUFFER,       /**< node::Buffer */
+  SHIM_TYPE_ARRAY_BUFFER, /**< ArrayBuffer */
+  SHIM_TYPE_TYPED_ARRAY,  /**< Any of the typed array views */
 } shim_type_t;
 
 /**
  * The opaque handle that represents a javascript value
  *
- * You should use shim_value_release
+ * Values handed out during a boundary call come from the context's arena and
+ * go away with it, only those from shim_value_alloc need shim_value_release
  */
 typedef struct shim_val_s shim_val_t;
 
@@ -229,6 +232,36 @@ typedef struct shim_fspec_s {
 #define SHIM_FS_END                                                           \
   { NULL, NULL, 0, NULL, 0, 0 }
 
+/** The signature of a native property getter */
+typedef int (* shim_getter)(shim_ctx_t*, shim_val_t* self, const char* name,
+  shim_val_t** rval, void* data);
+/** The signature of a native property setter */
+typedef int (* shim_setter)(shim_ctx_t*, shim_val_t* self, const char* name,
+  shim_val_t* val, void* data);
+
+/**
+ * Describes a property backed by C callbacks
+ * \sa shim_obj_set_accessors()
+ */
+typedef struct shim_aspec_s {
+  const char* name;   /**< Name of the property */
+  shim_getter getter; /**< Called when the property is read */
+  shim_setter setter; /**< Called when the property is written, may be NULL */
+  void* data;         /**< Arbitrary data associated with the property */
+  uint32_t flags;     /**< Flags for the property */
+  uint32_t reserved;  /**< Reserved for future use */
+} shim_aspec_t;
+
+/** Define a property with a getter and an optional setter */
+#define SHIM_AS(name, getter, setter, data)                                   \
+  { name, getter, setter, data, 0, 0 }
+/** Define a read only property */
+#define SHIM_AS_RO(name, getter, data)                                        \
+  SHIM_AS(name, getter, NULL, data)
+/** Sentinel that indicates we're done defining accessors */
+#define SHIM_AS_END                                                           \
+  { NULL, NULL, NULL, NULL, 0, 0 }
+
 /**@}*/
 
 /**
@@ -242,8 +275,8 @@ shim_bool_t shim_value_is(shim_val_t* val, shim_type_t type);
 /**
  * Convert the value to a given type
  *
- * On success rval will be allocated for you, and you are responsible for
- * shim_value_release unless it is being used with shim_args_set_rval
+ * On success rval comes from the context's arena and stays valid until the
+ * boundary call returns, there is nothing to release
  */
 shim_bool_t shim_value_to(shim_ctx_t* ctx, shim_val_t* val, shim_type_t type,
   shim_val_t** rval);
@@ -251,7 +284,7 @@ shim_bool_t shim_value_to(shim_ctx_t* ctx, shim_val_t* val, shim_type_t type,
 
 /** Allocate memory to hold an arbitrary value. */
 shim_val_t *shim_value_alloc(void);
-/** Release memory associated with this value */
+/** Release a value from shim_value_alloc, arena values are left alone */
 void shim_value_release(shim_val_t* val);
 
 /** Get the undefined value */
@@ -260,6 +293,9 @@ shim_val_t* shim_undefined();
 shim_val_t* shim_null();
 
 const char* shim_type_str(shim_type_t type);
+
+/** Toggle tracing of boundary calls to stderr */
+void shim_trace_enable(shim_bool_t enabled);
 /**@}*/
 
 
@@ -297,17 +333,20 @@ shim_bool_t shim_obj_set_prop_id(shim_ctx_t* ctx, shim_val_t* recv,
 /** Set the value for the given symbol */
 shim_bool_t shim_obj_set_prop_sym(shim_ctx_t* ctx, shim_val_t* recv,
   shim_val_t* sym, shim_val_t* val);
-/** Add arbitrary data to given object */
+/** Add arbitrary data to given object, class instances keep it in a field */
 shim_bool_t shim_obj_set_private(shim_ctx_t* ctx, shim_val_t* obj, void* data);
 /** Adds a set of functions to an object */
 shim_bool_t shim_obj_set_funcs(shim_ctx_t* ctx, shim_val_t* recv,
   const shim_fspec_t* funcs);
+/** Adds a set of native backed properties to an object */
+shim_bool_t shim_obj_set_accessors(shim_ctx_t* ctx, shim_val_t* recv,
+  const shim_aspec_t* accessors);
 
 /**
  * Get the value for the property name
  *
- * On success rval will be allocated for you, and you are responsible for
- * shim_value_release unless it is being used with shim_args_set_rval
+ * On success rval comes from the context's arena and stays valid until the
+ * boundary call returns, there is nothing to release
  */
 shim_bool_t shim_obj_get_prop_name(shim_ctx_t* ctx, shim_val_t* obj,
   const char* name, shim_val_t** rval);
@@ -315,8 +354,8 @@ shim_bool_t shim_obj_get_prop_name(shim_ctx_t* ctx, shim_val_t* obj,
 /**
  * Get the value for the given id
  *
- * On success rval will be allocated for you, and you are responsible for
- * shim_value_release unless it is being used with shim_args_set_rval
+ * On success rval comes from the context's arena and stays valid until the
+ * boundary call returns, there is nothing to release
  */
 shim_bool_t shim_obj_get_prop_id(shim_ctx_t* ctx, shim_val_t* obj,
   uint32_t id, shim_val_t** rval);
@@ -324,8 +363,8 @@ shim_bool_t shim_obj_get_prop_id(shim_ctx_t* ctx, shim_val_t* obj,
 /**
  * Get the value for the given symbol
  *
- * On success rval will be allocated for you, and you are responsible for
- * shim_value_release unless it is being used with shim_args_set_rval
+ * On success rval comes from the context's arena and stays valid until the
+ * boundary call returns, there is nothing to release
  */
 shim_bool_t shim_obj_get_prop_sym(shim_ctx_t* ctx, shim_val_t* obj,
   shim_val_t* sym, shim_val_t** rval);
@@ -333,14 +372,192 @@ shim_bool_t shim_obj_get_prop_sym(shim_ctx_t* ctx, shim_val_t* obj,
 /**
  * Get the arbitrary data associated with the object
  *
- * On success rval will be allocated for you, and you are responsible for
- * shim_value_release unless it is being used with shim_args_set_rval
+ * On success data is the pointer given to shim_obj_set_private, nothing is
+ * allocated
  */
 shim_bool_t shim_obj_get_private(shim_ctx_t* ctx, shim_val_t* obj, void** data);
 
 /**@}*/
 
 
+/**
+ * \defgroup keys Key methods
+ * Methods for property names that are looked up over and over
+ * @{
+ */
+
+/**
+ * \typedef shim_key_t
+ * \brief Opaque pointer to an interned property name
+ */
+typedef struct shim_key_s shim_key_t;
+
+/** Intern a property name once so lookups do no string work */
+shim_key_t* shim_key_new(shim_ctx_t* ctx, const char* name);
+/** Release an interned property name */
+void shim_key_dispose(shim_key_t* key);
+
+/** Check the object has the given key */
+shim_bool_t shim_obj_has_key(shim_ctx_t* ctx, shim_val_t* obj,
+  shim_key_t* key);
+/** Set the value for the given key */
+shim_bool_t shim_obj_set_prop_key(shim_ctx_t* ctx, shim_val_t* recv,
+  shim_key_t* key, shim_val_t* val);
+
+/**
+ * Get the value for the given key
+ *
+ * On success rval comes from the context's arena and stays valid until the
+ * boundary call returns, there is nothing to release
+ */
+shim_bool_t shim_obj_get_prop_key(shim_ctx_t* ctx, shim_val_t* obj,
+  shim_key_t* key, shim_val_t** rval);
+
+/**
+ * Get the function by key from an object and call it
+ *
+ * On success rval comes from the context's arena and stays valid until the
+ * boundary call returns, there is nothing to release
+ */
+shim_bool_t shim_func_call_key(shim_ctx_t* ctx, shim_val_t* self,
+  shim_key_t* key, size_t argc, shim_val_t** argv, shim_val_t** rval);
+
+/**
+ * \typedef shim_shape_t
+ * \brief Opaque pointer to an ordered set of keys objects are built from
+ */
+typedef struct shim_shape_s shim_shape_t;
+
+/** Declare the properties, in order, of objects that will be built alike */
+shim_shape_t* shim_shape_new(shim_ctx_t* ctx, const char** names,
+  size_t count);
+/** Release a shape */
+void shim_shape_dispose(shim_shape_t* shape);
+/** Build an object of the shape with one value per key */
+shim_val_t* shim_shape_new_obj(shim_ctx_t* ctx, shim_shape_t* shape,
+  shim_val_t** vals);
+
+/**
+ * Describes a property to copy into a member of a C struct
+ * \sa shim_extract_new()
+ */
+typedef struct shim_field_s {
+  const char* name;   /**< Name of the property */
+  shim_type_t type;   /**< Type the property must have */
+  size_t offset;      /**< Offset of the member in the struct */
+} shim_field_t;
+
+/** Define a field read from the named property into the struct member */
+#define SHIM_FIELD(name, type, st, member)                                    \
+  { name, type, (size_t) offset_of(st, member) }
+/** Sentinel that indicates we're done defining fields */
+#define SHIM_FIELD_END                                                        \
+  { NULL, SHIM_TYPE_UNKNOWN, 0 }
+
+/**
+ * \typedef shim_extract_t
+ * \brief Opaque pointer to a compiled set of fields
+ */
+typedef struct shim_extract_s shim_extract_t;
+
+/** Compile a field table so objects can be extracted in one pass */
+shim_extract_t* shim_extract_new(shim_ctx_t* ctx, const shim_field_t* fields);
+/** Release a compiled field table */
+void shim_extract_dispose(shim_extract_t* extract);
+/** Copy the properties of an object into a C struct */
+shim_bool_t shim_obj_extract(shim_ctx_t* ctx, shim_val_t* obj,
+  shim_extract_t* extract, void* dest);
+
+/**@}*/
+
+
+/**
+ * \defgroup classes Class methods
+ * Methods for defining native classes
+ * @{
+ */
+
+/**
+ * \typedef shim_class_t
+ * \brief Opaque pointer to a class defined through the addon layer
+ */
+typedef struct shim_class_s shim_class_t;
+
+/** Define a class whose constructor calls the given C function */
+shim_class_t* shim_class_new(shim_ctx_t* ctx, const char* name,
+  shim_func ctor, size_t argc, void* data);
+/** Adds a set of methods to the prototype of the class */
+shim_bool_t shim_class_set_funcs(shim_ctx_t* ctx, shim_class_t* klass,
+  const shim_fspec_t* funcs);
+/** Adds a set of native backed properties to every instance of the class */
+shim_bool_t shim_class_set_accessors(shim_ctx_t* ctx, shim_class_t* klass,
+  const shim_aspec_t* accessors);
+/** Get the constructor function of the class */
+shim_val_t* shim_class_get_ctor(shim_ctx_t* ctx, shim_class_t* klass);
+/** Create an instance of the class without calling its constructor */
+shim_val_t* shim_class_new_instance(shim_ctx_t* ctx, shim_class_t* klass);
+/** Check the value is an instance of the class */
+shim_bool_t shim_class_is(shim_ctx_t* ctx, shim_class_t* klass,
+  shim_val_t* val);
+
+/** Read an index, return FALSE to fall through to the real property */
+typedef int (* shim_index_getter)(shim_ctx_t*, shim_val_t* self, uint32_t idx,
+  shim_val_t** rval, void* data);
+/** Write an index, return FALSE to fall through to the real property */
+typedef int (* shim_index_setter)(shim_ctx_t*, shim_val_t* self, uint32_t idx,
+  shim_val_t* val, void* data);
+/** Return TRUE if the index exists */
+typedef int (* shim_index_query)(shim_ctx_t*, shim_val_t* self, uint32_t idx,
+  void* data);
+/** Read a name, return FALSE to fall through to the real property */
+typedef int (* shim_named_getter)(shim_ctx_t*, shim_val_t* self,
+  const char* name, shim_val_t** rval, void* data);
+/** Write a name, return FALSE to fall through to the real property */
+typedef int (* shim_named_setter)(shim_ctx_t*, shim_val_t* self,
+  const char* name, shim_val_t* val, void* data);
+/** Return TRUE if the name exists */
+typedef int (* shim_named_query)(shim_ctx_t*, shim_val_t* self,
+  const char* name, void* data);
+/** Set rval to an array of the indexes or names that exist */
+typedef int (* shim_prop_enumerator)(shim_ctx_t*, shim_val_t* self,
+  shim_val_t** rval, void* data);
+
+/**
+ * Callbacks that answer indexed property access on class instances
+ * \sa shim_class_set_indexed()
+ */
+typedef struct shim_index_handler_s {
+  shim_index_getter getter;        /**< Called when an index is read */
+  shim_index_setter setter;        /**< Called on write, may be NULL */
+  shim_index_query query;          /**< Called by `in`, may be NULL */
+  shim_prop_enumerator enumerator; /**< Called to list indexes, may be NULL */
+  void* data;                      /**< Arbitrary data for the callbacks */
+} shim_index_handler_t;
+
+/**
+ * Callbacks that answer named property access on class instances
+ * \sa shim_class_set_named()
+ */
+typedef struct shim_named_handler_s {
+  shim_named_getter getter;        /**< Called when a name is read */
+  shim_named_setter setter;        /**< Called on write, may be NULL */
+  shim_named_query query;          /**< Called by `in`, may be NULL */
+  shim_prop_enumerator enumerator; /**< Called to list names, may be NULL */
+  void* data;                      /**< Arbitrary data for the callbacks */
+  const char* prefix;              /**< Only intercept names with this prefix,
+                                        may be NULL for every name */
+} shim_named_handler_t;
+
+/** Answer indexed property access on instances from C */
+shim_bool_t shim_class_set_indexed(shim_ctx_t* ctx, shim_class_t* klass,
+  const shim_index_handler_t* handler);
+/** Answer named property access on instances from C */
+shim_bool_t shim_class_set_named(shim_ctx_t* ctx, shim_class_t* klass,
+  const shim_named_handler_t* handler);
+
+/**@}*/
+
+
 /**
  * \defgroup persistents Persistent methods
  * Methods for persistents
@@ -354,8 +571,8 @@ void shim_persistent_dispose(shim_persistent_t* val);
 
 /** Convert a persitent value to a local
  *
- * On success val will be allocated for you, and you are responsible for
- * shim_value_release unless it is being used with shim_args_set_rval
+ * On success val comes from the context's arena and stays valid until the
+ * boundary call returns, there is nothing to release
  */
 shim_bool_t shim_persistent_to_val(shim_ctx_t* ctx, shim_persistent_t* pval,
   shim_val_t** val);
@@ -382,12 +599,24 @@ void shim_obj_clear_weak(shim_persistent_t* val);
 shim_val_t* shim_func_new(shim_ctx_t* ctx, shim_func cfunc, size_t argc,
   int32_t flags, const char* name, void* data);
 
+/**
+ * \struct shim_func_stats_s
+ * \brief Counters for the bookkeeping behind functions from shim_func_new
+ */
+typedef struct shim_func_stats_s {
+  size_t live;     /**< Holders not freed yet, all of them before 0.11.13 */
+  size_t created;  /**< Holders created since startup */
+} shim_func_stats_t;
+
+/** Get the counters for functions created through the addon layer */
+void shim_func_stats(shim_func_stats_t* stats);
+
 
 /**
  * Get the symbol from the object as a function and call it
  *
- * On success rval will be allocated for you, and you are responsible for
- * shim_value_release unless it is being used with shim_args_set_rval
+ * On success rval comes from the context's arena and stays valid until the
+ * boundary call returns, there is nothing to release
  */
 shim_bool_t shim_func_call_sym(shim_ctx_t* ctx, shim_val_t* self,
   shim_val_t* name, size_t argc, shim_val_t** argv, shim_val_t** rval);
@@ -395,8 +624,8 @@ shim_bool_t shim_func_call_sym(shim_ctx_t* ctx, shim_val_t* self,
 /**
  * Get the function by name from an object and call it
  *
- * On success rval will be allocated for you, and you are responsible for
- * shim_value_release unless it is being used with shim_args_set_rval
+ * On success rval comes from the context's arena and stays valid until the
+ * boundary call returns, there is nothing to release
  */
 shim_bool_t shim_func_call_name(shim_ctx_t* ctx, shim_val_t* self,
   const char* name, size_t argc, shim_val_t** argv, shim_val_t** rval);
@@ -404,8 +633,8 @@ shim_bool_t shim_func_call_name(shim_ctx_t* ctx, shim_val_t* self,
 /**
  * Call the given function
  *
- * On success rval will be allocated for you, and you are responsible for
- * shim_value_release unless it is being used with shim_args_set_rval
+ * On success rval comes from the context's arena and stays valid until the
+ * boundary call returns, there is nothing to release
  */
 shim_bool_t shim_func_call_val(shim_ctx_t* ctx, shim_val_t* self,
   shim_val_t* func, size_t argc, shim_val_t** argv, shim_val_t** rval);
@@ -414,8 +643,8 @@ shim_bool_t shim_func_call_val(shim_ctx_t* ctx, shim_val_t* self,
 /**
  * Get a function by symbol and process the callback
  *
- * On success rval will be allocated for you, and you are responsible for
- * shim_value_release unless it is being used with shim_args_set_rval
+ * On success rval comes from the context's arena and stays valid until the
+ * boundary call returns, there is nothing to release
  */
 shim_bool_t shim_make_callback_sym(shim_ctx_t* ctx, shim_val_t* self,
   shim_val_t* sym, size_t argc, shim_val_t** argv, shim_val_t** rval);
@@ -423,8 +652,8 @@ shim_bool_t shim_make_callback_sym(shim_ctx_t* ctx, shim_val_t* self,
 /**
  * Process the callback for the given function
  *
- * On success rval will be allocated for you, and you are responsible for
- * shim_value_release unless it is being used with shim_args_set_rval
+ * On success rval comes from the context's arena and stays valid until the
+ * boundary call returns, there is nothing to release
  */
 shim_bool_t shim_make_callback_val(shim_ctx_t* ctx, shim_val_t* self,
   shim_val_t* fval, size_t argc, shim_val_t** argv, shim_val_t** rval);
@@ -432,8 +661,8 @@ shim_bool_t shim_make_callback_val(shim_ctx_t* ctx, shim_val_t* self,
 /**
  * Process the callback for the given name
  *
- * On success rval will be allocated for you, and you are responsible for
- * shim_value_release unless it is being used with shim_args_set_rval
+ * On success rval comes from the context's arena and stays valid until the
+ * boundary call returns, there is nothing to release
  */
 shim_bool_t shim_make_callback_name(shim_ctx_t* ctx, shim_val_t* obj,
   const char* name, size_t argc, shim_val_t** argv, shim_val_t** rval);
@@ -506,8 +735,8 @@ size_t shim_array_length(shim_val_t* arr);
 /**
  * Get the value at the given index
  *
- * On success rval will be allocated for you, and you are responsible for
- * shim_value_release unless it is being used with shim_args_set_rval
+ * On success rval comes from the context's arena and stays valid until the
+ * boundary call returns, there is nothing to release
  */
 shim_bool_t shim_array_get(shim_ctx_t* ctx, shim_val_t* arr, int32_t idx,
   shim_val_t** rval);
@@ -516,6 +745,19 @@ shim_bool_t shim_array_get(shim_ctx_t* ctx, shim_val_t* arr, int32_t idx,
 shim_bool_t shim_array_set(shim_ctx_t* ctx, shim_val_t* arr, int32_t idx,
   shim_val_t* val);
 
+/** Copy a numeric Array or typed array into a buffer of doubles */
+shim_bool_t shim_array_to_doubles(shim_ctx_t* ctx, shim_val_t* arr,
+  double* out, size_t len, size_t* written);
+/** Copy a numeric Array or typed array into a buffer of int32s */
+shim_bool_t shim_array_to_int32s(shim_ctx_t* ctx, shim_val_t* arr,
+  int32_t* out, size_t len, size_t* written);
+/** Create an Array from a buffer of doubles */
+shim_val_t* shim_array_from_doubles(shim_ctx_t* ctx, const double* data,
+  size_t len);
+/** Create an Array from a buffer of int32s */
+shim_val_t* shim_array_from_int32s(shim_ctx_t* ctx, const int32_t* data,
+  size_t len);
+
 /**@}*/
 
 /**
@@ -541,6 +783,48 @@ size_t shim_buffer_length(shim_val_t*);
 
 /**@}*/
 
+/**
+ * \defgroup typedarrays Typed array methods
+ * Methods for ArrayBuffers and typed arrays
+ * @{
+ */
+
+/** The element types of typed arrays */
+typedef enum shim_typed {
+  SHIM_TYPED_UNKNOWN = 0, /**< Not a typed array */
+  SHIM_TYPED_INT8,        /**< Int8Array */
+  SHIM_TYPED_UINT8,       /**< Uint8Array */
+  SHIM_TYPED_UINT8_CLAMPED, /**< Uint8ClampedArray */
+  SHIM_TYPED_INT16,       /**< Int16Array */
+  SHIM_TYPED_UINT16,      /**< Uint16Array */
+  SHIM_TYPED_INT32,       /**< Int32Array */
+  SHIM_TYPED_UINT32,      /**< Uint32Array */
+  SHIM_TYPED_FLOAT32,     /**< Float32Array */
+  SHIM_TYPED_FLOAT64,     /**< Float64Array */
+} shim_typed_t;
+
+/** The memory of an ArrayBuffer or typed array, as unpacked */
+typedef struct shim_buffer_view {
+  void* data;         /**< The memory, used in place */
+  size_t len;         /**< Elements, bytes for an ArrayBuffer */
+  shim_typed_t type;  /**< Element type, SHIM_TYPED_UINT8 for an ArrayBuffer */
+} shim_buffer_view_t;
+
+/** Get the memory backing an ArrayBuffer and its length in bytes */
+void* shim_array_buffer_value(shim_val_t* val, size_t* len);
+/** Get the memory, element count and element type of a typed array */
+void* shim_typed_array_value(shim_val_t* val, size_t* len,
+  shim_typed_t* type);
+
+/** Create an ArrayBuffer over memory owned by the caller */
+shim_val_t* shim_array_buffer_new_external(shim_ctx_t* ctx, void* data,
+  size_t len);
+/** Create a typed array over memory owned by the caller */
+shim_val_t* shim_typed_array_new_external(shim_ctx_t* ctx, void* data,
+  size_t len, shim_typed_t type);
+
+/**@}*/
+
 /**
  * \defgroup externals External methods
  * Methods for externals
@@ -577,8 +861,8 @@ void shim_exception_set(shim_ctx_t* ctx, shim_val_t* val);
 /**
  * Get the pending exception
  *
- * On success rval will be allocated for you, and you are responsible for
- * shim_value_release unless it is being used with shim_args_set_rval
+ * On success rval comes from the context's arena and stays valid until the
+ * boundary call returns, there is nothing to release
  */
 shim_bool_t shim_exception_get(shim_ctx_t* ctx, shim_val_t** rval);
 
@@ -600,8 +884,9 @@ void shim_throw_range_error(shim_ctx_t* ctx, const char* msg, ...);
 /**
  * Unpack the argument at the given index
  *
- * On success rval will be allocated for you, and you are responsible for
- * shim_value_release unless it is being used with shim_args_set_rval
+ * Scalars are stored straight to rval. Strings and functions are stored as a
+ * ::shim_val_t* from the context's arena, valid until the boundary call
+ * returns, there is nothing to release
  */
 shim_bool_t shim_unpack_one(shim_ctx_t* ctx, shim_args_t* args, uint32_t idx,
   shim_type_t type, void* rval);
@@ -609,8 +894,11 @@ shim_bool_t shim_unpack_one(shim_ctx_t* ctx, shim_args_t* args, uint32_t idx,
 /**
  * Unpack the value to the underlying type
  *
- * On success rval will be allocated for you, and you are responsible for
- * shim_value_release unless it is being used with shim_args_set_rval
+ * Scalars are stored straight to rval. Strings and functions are stored as a
+ * ::shim_val_t* from the context's arena, valid until the boundary call
+ * returns, there is nothing to release
+ *
+ * ArrayBuffers and typed arrays unpack into a ::shim_buffer_view_t
  */
 shim_bool_t shim_unpack_type(shim_ctx_t* ctx, shim_val_t* arg,
   shim_type_t type, void* rval);
@@ -618,7 +906,11 @@ shim_bool_t shim_unpack_type(shim_ctx_t* ctx, shim_val_t* arg,
 /** Unpack the arguments into underlying types */
 shim_bool_t shim_unpack(shim_ctx_t* ctx, shim_args_t* args, shim_type_t type,
   ...);
-/** Unpack the arguments by format */
+/**
+ * Unpack the arguments by format
+ *
+ * The format is compiled once and cached by its contents
+ */
 int shim_unpack_fmt(shim_ctx_t* ctx, shim_args_t* args, const char* fmt, ...);
 
 /** How many arguments were passed to this function */
@@ -647,12 +939,120 @@ void* shim_args_get_data(shim_ctx_t* ctx, shim_args_t* args);
  */
 typedef struct shim_work_s shim_work_t;
 
+/**
+ * \struct shim_work_handle_s
+ * \brief Names a queued job, safe to keep around after the job finished
+ */
+typedef struct shim_work_handle_s {
+  uint32_t slot;  /**< Where the job is tracked */
+  uint32_t gen;   /**< Which use of the slot the job was */
+} shim_work_handle_t;
+
 /** Callback on a different thread to do computation */
 typedef void (* shim_work_cb)(shim_work_t*, void*);
 /** Callback on main thread to return to JS */
 typedef void (* shim_after_work)(shim_ctx_t*, shim_work_t*, int, void*);
 /** Queue work to be done on background thread */
-void shim_queue_work(shim_work_cb, shim_after_work, void* hint);
+shim_work_handle_t shim_queue_work(shim_work_cb, shim_after_work, void* hint);
+/** Cancel queued work that hasn't started running yet */
+int shim_work_cancel(shim_work_handle_t handle);
+
+/** Callback on main thread with the progress published since the last one */
+typedef void (* shim_progress_cb)(shim_ctx_t*, shim_work_t*, const char* data,
+  size_t len, void*);
+/** Queue work that can publish progress while it runs */
+shim_work_handle_t shim_queue_work_progress(shim_work_cb work_cb,
+  shim_progress_cb progress_cb, shim_after_work after_cb, void* hint,
+  uint32_t flags);
+/** Publish progress from inside a work callback */
+void shim_work_progress(shim_work_t* work, const char* data, size_t len);
+
+/** Run the job on the addon layer's pool instead of the libuv threadpool */
+#define SHIM_WORK_POOL 0x01
+/** Deliver the completion in bulk, sharing one scope with other jobs */
+#define SHIM_WORK_COALESCE 0x02
+/** Run ahead of normal and background jobs, implies SHIM_WORK_POOL */
+#define SHIM_WORK_PRIORITY_HIGH 0x04
+/** Run only once no other jobs wait, implies SHIM_WORK_POOL */
+#define SHIM_WORK_PRIORITY_BACKGROUND 0x08
+
+/** Finished jobs delivered per turn of the loop unless told otherwise */
+#define SHIM_WORK_DRAIN_MAX 256
+/** Set how many finished jobs a single bulk delivery may handle */
+void shim_work_drain_max(size_t max);
+
+/** Queue work with flags describing where and how it runs */
+shim_work_handle_t shim_queue_work_flags(shim_work_cb, shim_after_work,
+  void* hint, uint32_t flags);
+
+/** Number of threads the addon pool starts with unless told otherwise */
+#define SHIM_POOL_DEFAULT_SIZE 4
+/** Pin each addon pool thread to a core (Linux only) */
+#define SHIM_POOL_PIN 0x01
+
+/** Start the addon layer's own thread pool */
+int shim_pool_start(size_t nthreads, uint32_t flags);
+/** Stop the addon pool, cancelling the jobs that haven't started */
+int shim_pool_stop(void);
+
+/**
+ * \typedef shim_batch_t
+ * \brief Opaque pointer to a queued batch of work
+ */
+typedef struct shim_batch_s shim_batch_t;
+
+/** Callback on main thread once a chunk of the batch has finished */
+typedef void (* shim_after_batch)(shim_ctx_t*, shim_batch_t*, int,
+  void** items, size_t count, void*);
+/** Queue many items to be done on background threads with one completion */
+int shim_queue_work_batch(shim_work_cb work_cb, shim_after_batch after_cb,
+  void** items, size_t count, size_t granularity, void* hint);
+
+/**
+ * \struct shim_work_stats_s
+ * \brief Counters for the pool of reusable work records
+ */
+typedef struct shim_work_stats_s {
+  size_t hits;    /**< Jobs that reused a pooled record */
+  size_t misses;  /**< Jobs that had to allocate a record */
+  size_t idle;    /**< Records currently waiting in the pool */
+  size_t max;     /**< Most records the pool will hold */
+} shim_work_stats_t;
+
+/** Set the high-water mark for idle work records */
+void shim_work_pool_max(size_t max);
+/** Get the counters for the work record pool */
+void shim_work_pool_stats(shim_work_stats_t* stats);
+
+/**
+ * \typedef shim_channel_t
+ * \brief Opaque pointer to a channel from native threads to a JS function
+ */
+typedef struct shim_channel_s shim_channel_t;
+
+/** Callback on main thread to turn a payload into a value for JS */
+typedef shim_val_t* (* shim_channel_convert)(shim_ctx_t*, shim_channel_t*,
+  void* payload, void*);
+
+/** Block the sending thread while the channel is full */
+#define SHIM_CHANNEL_BLOCK 0
+/** Hand the payload back to the sender while the channel is full */
+#define SHIM_CHANNEL_DROP 1
+
+/** The payload was queued */
+#define SHIM_CHANNEL_OK 0
+/** The channel was full and the payload was not queued */
+#define SHIM_CHANNEL_FULL 1
+/** The channel was closed and the payload was not queued */
+#define SHIM_CHANNEL_CLOSED 2
+
+/** Create a channel that calls a JS function with payloads from any thread */
+shim_channel_t* shim_channel_new(shim_ctx_t* ctx, shim_val_t* fn,
+  size_t capacity, int policy, shim_channel_convert convert, void* hint);
+/** Queue a payload for the JS function from any thread, never after close */
+int shim_channel_send(shim_channel_t* channel, void* payload);
+/** Stop accepting payloads and release the channel once drained */
+void shim_channel_close(shim_channel_t* channel);
 
 /**@}*/
 
@@ -29,6 +29,9 @@
 #include "v8.h"
 #include "node.h"
 #include "node_buffer.h"
+#include "uv.h"
+
+#include "queue.h"
 
 
 #if NODE_VERSION_AT_LEAST(0, 11, 3)
@@ -39,14 +42,22 @@
 #define SHIM__TO_LOCAL(x) v8::Local<v8::Value>::New(x)
 #endif
 
+#if NODE_VERSION_AT_LEAST(0, 11, 3)
+#define SHIM__ARGS_TYPE v8::FunctionCallbackInfo<v8::Value>
+#else
+#define SHIM__ARGS_TYPE v8::Arguments
+#endif
+
 struct shim_val_s {
   SHIM__HANDLE_TYPE handle;
   enum shim_type type;
+  /* only values from shim_value_alloc() are owned by shim_value_release() */
+  bool heap;
 
-  shim_val_s(SHIM__HANDLE_TYPE v, enum shim_type t = SHIM_TYPE_UNKNOWN) : handle(v), type(t) {
+  shim_val_s(SHIM__HANDLE_TYPE v, enum shim_type t = SHIM_TYPE_UNKNOWN) : handle(v), type(t), heap(false) {
   }
 
-  shim_val_s() : type(SHIM_TYPE_UNKNOWN) {
+  shim_val_s() : type(SHIM_TYPE_UNKNOWN), heap(false) {
   }
 };
 
@@ -56,27 +67,245 @@ struct shim_persistent_s {
 };
 
 
+/* Keys are never made weak so the handle can be used in place */
+struct shim_key_s {
+  v8::Persistent<v8::String> handle;
+};
+
+
+/*
+ * The template already holds every key, in order, so instances start out
+ * with the final hidden class and filling them in never transitions it
+ */
+struct shim_shape_s {
+  v8::Persistent<v8::ObjectTemplate> tmpl;
+  shim_key_s* keys;
+  size_t count;
+};
+
+
+/* A field table with its names interned ahead of time */
+struct shim_extract_s {
+  shim_field_t* fields;
+  shim_key_s* keys;
+  size_t count;
+};
+
+
+struct shim_fholder_s {
+  shim_func cfunc;
+  void* data;
+  /* captured once so tracing never has to transcode the callee name */
+  char* name;
+  int32_t flags;
+  /* weak from 0.11.13, the holder is freed once the function is collected */
+  v8::Persistent<v8::Value> fn;
+};
+
+#if ! NODE_VERSION_AT_LEAST(0, 11, 13)
+/*
+ * Before Function::New a function can only come from a template, and the
+ * context keeps it for good either way, so a template is made once per
+ * (cfunc, flags, data, name) and instantiated from then on
+ */
+struct shim_ftmpl_s {
+  shim_fholder_s* holder;
+  v8::Persistent<v8::FunctionTemplate> tmpl;
+  shim_ftmpl_s* next;
+};
+
+/* Buckets of the template cache, entries chain and are never freed */
+#define SHIM_FUNC_TMPL_BUCKETS 64
+#endif
+
+/* Internal fields of class instances, the private pointer then our marker */
+#define SHIM_CLASS_FIELDS 2
+
+/*
+ * Classes live as long as the process, instances get an internal field for
+ * the private pointer and one marking them as ours, so V8 can give them all
+ * one hidden class
+ */
+struct shim_class_s {
+  v8::Persistent<v8::FunctionTemplate> tmpl;
+  shim_fholder_s* ctor;
+};
+
+
+/* Size of the chunks the per context arena carves values out of */
+#define SHIM_ARENA_CHUNK_SIZE 4096
+/* How many idle chunks are kept around for the next boundary call */
+#define SHIM_ARENA_CACHE_MAX 16
+
+#define SHIM_ARENA_ALIGN(n) \
+  (((n) + sizeof(void*) - 1) & ~(sizeof(void*) - 1))
+
+struct shim_arena_chunk_s {
+  shim_arena_chunk_s* next;
+  size_t size;
+  size_t used;
+  void* data[1];
+};
+
+
+/*
+ * Bump allocator for everything wrapped while a context is alive, wrappers
+ * only hold Locals so they can't outlive the scope anyway
+ */
+struct shim_arena_s {
+  shim_arena_chunk_s* head;
+
+  shim_arena_s() : head(NULL) {
+  }
+};
+
+
 struct shim_ctx_s {
   v8::HandleScope* scope;
   v8::Isolate* isolate;
   v8::TryCatch* trycatch;
-  void* allocs;
+  shim_arena_s* allocs;
 };
 
 
+/* Property names up to this long are transcoded for interceptors on the stack */
+#define SHIM_NAME_INLINE 64
+
+/* Calls with up to this many arguments are wrapped in place on the C stack */
+#define SHIM_ARGS_INLINE 8
+
+/*
+ * argv slots start out NULL and are only wrapped from info the first time
+ * they're asked for
+ */
 struct shim_args_s {
   size_t argc;
   shim_val_s *self;
   shim_val_s **argv;
   shim_val_s *ret;
   void* data;
+  shim_ctx_s* ctx;
+  const SHIM__ARGS_TYPE* info;
+  shim_val_s self_val;
+  shim_val_s* argv_inline[SHIM_ARGS_INLINE];
+  shim_val_s vals_inline[SHIM_ARGS_INLINE];
 };
 
 
+/* Elements converted per inner handle scope by the bulk array kernels */
+#define SHIM_ARRAY_CHUNK 1024
+
+
+/* Idle work records kept for reuse unless changed by shim_work_pool_max */
+#define SHIM_WORK_POOL_MAX 128
+
+/* Priority lanes of the addon pool, scanned from high to background */
+#define SHIM_WORK_LANES 3
+
+/* The slot of a job that was never handed out, like a batch chunk */
+#define SHIM_WORK_NO_SLOT 0xffffffffu
+
+/* The status a cancelled job completes with, matching what libuv reports */
+#if NODE_VERSION_AT_LEAST(0, 11, 5)
+#define SHIM__ECANCELED UV_ECANCELED
+#else
+#define SHIM__ECANCELED -1
+#endif
+
+/*
+ * Progress published by a running job, the worker appends to data while the
+ * loop thread delivers whatever it swapped out into spare last turn
+ */
+struct shim_progress_s {
+  uv_async_t async;
+  uv_mutex_t lock;
+  shim_progress_cb progress_cb;
+  shim_work_s* work;
+  char* data;
+  size_t len;
+  size_t size;
+  char* spare;
+  size_t spare_size;
+};
+
+
+/* The uv request is embedded so a job is a single allocation */
 struct shim_work_s {
+  uv_work_t req;
   shim_work_cb work_cb;
   shim_after_work after_cb;
   void* hint;
+  uint32_t flags;
+  int status;
+  /* where the handle given out for the job points */
+  uint32_t slot;
+  /* the addon pool worker whose lane holds the job, guarded by its lock */
+  size_t owner;
+  bool queued;
+  shim_progress_s* progress;
+  shim_batch_s* batch;
+  shim_work_s* next;
+  QUEUE member;
+};
+
+
+/*
+ * A thread of the addon pool, jobs are dealt round robin to each worker's
+ * lanes which it drains from the front while idle workers steal from the back
+ */
+struct shim_worker_s {
+  uv_thread_t thread;
+  uv_mutex_t lock;
+  QUEUE lanes[SHIM_WORK_LANES];
+  size_t index;
+};
+
+
+/*
+ * Payloads wait in a fixed ring until the loop thread drains them, drain is
+ * where the ring is copied to so the lock isn't held while calling into
+ * javascript. senders counts the threads inside shim_channel_send, the
+ * channel is only freed once none are left and the handle is released.
+ */
+struct shim_channel_s {
+  uv_async_t async;
+  uv_mutex_t lock;
+  uv_cond_t cond;
+  shim_persistent_s* fn;
+  shim_channel_convert convert;
+  void* hint;
+  int policy;
+  bool closed;
+  bool released;
+  size_t senders;
+  size_t capacity;
+  size_t head;
+  size_t len;
+  void** ring;
+  void** drain;
+};
+
+
+/* Chunks a batch delivered as a whole is split into, one per libuv thread */
+#define SHIM_BATCH_SPLIT 4
+
+/*
+ * Each chunk of items is a single threadpool job, chunks complete in any
+ * order so done collects their items in completion order and each delivery
+ * hands out a contiguous slice, items is the copy made at queue time
+ */
+struct shim_batch_s {
+  shim_work_cb work_cb;
+  shim_after_batch after_cb;
+  void* hint;
+  size_t count;
+  size_t chunk;
+  size_t granularity;
+  size_t finished;
+  size_t delivered;
+  int status;
+  void** items;
+  void* done[1];
 };
 
 
@@ -114,4 +343,11 @@ typedef struct weak_baton_s {
 #define OBJ_TO_FUNCTION(obj) \
   ((obj)->IsFunction() ? (obj).As<Function>() : Local<Function>::Cast(obj))
 
+namespace shim {
+
+/* Get the wrapper for an argument, wrapping it on first access */
+shim_val_s* shim_args_at(shim_args_s* args, size_t idx);
+
+} /* namespace shim */
+
 #endif
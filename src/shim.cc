@@ -21,20 +21,31 @@
  * USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 
+#include <cmath>
 #include <cstdarg>
 #include <cstdlib>
 #include <cstring>
+#include <new>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
 
 #include "uv.h"
 
 #include "shim-impl.h"
+#include "shim-unpack.h"
 
 namespace shim {
 
 #if NODE_VERSION_AT_LEAST(0, 11, 3)
 using v8::FunctionCallbackInfo;
+using v8::PropertyCallbackInfo;
 #else
 using node::Buffer;
+using v8::AccessorInfo;
 using v8::Arguments;
 #endif
 
@@ -51,7 +62,9 @@ using v8::Local;
 using v8::Number;
 using v8::Null;
 using v8::Object;
+using v8::ObjectTemplate;
 using v8::Persistent;
+using v8::Signature;
 using v8::String;
 using v8::TryCatch;
 using v8::Undefined;
@@ -76,9 +89,11 @@ do {} while(0)
 
 #define SHIM_CTX(ctx)                                                         \
   shim_ctx_s ctx;                                                             \
+  shim_arena_s ctx ## _arena;                                                 \
   ctx.isolate = ctx ## _isolate;                                              \
   ctx.scope = &ctx ## _scope;                                                 \
   ctx.trycatch = &ctx ## _trycatch;                                           \
+  ctx.allocs = &ctx ## _arena;                                                \
 do {} while(0)
 
 
@@ -88,14 +103,102 @@ do {} while(0)
 #define SHIM_DEBUG(...)
 #endif
 
+/* Boundary call tracing, switched on at runtime with SHIM_TRACE=1 */
+#define SHIM_TRACE(...)                                                       \
+  do {                                                                        \
+    if (shim_tracing)                                                         \
+      fprintf(stderr, __VA_ARGS__);                                           \
+  } while (0)
+
+int shim_tracing = 0;
+
 Persistent<String> hidden_private;
+/* interned once, both are looked up on every typed array access */
+Persistent<String> hidden_view;
+Persistent<String> array_buffer_name;
 
 shim_val_s shim__undefined;
 shim_val_s shim__null;
 
+/* chunks are only ever touched from the thread running javascript */
+shim_arena_chunk_s* arena_cache = NULL;
+size_t arena_cache_len = 0;
+
+void*
+shim_arena_alloc(shim_arena_s* arena, size_t size)
+{
+  size = SHIM_ARENA_ALIGN(size);
+
+  shim_arena_chunk_s* chunk = arena->head;
+
+  if (chunk == NULL || chunk->used + size > chunk->size) {
+    if (size <= SHIM_ARENA_CHUNK_SIZE && arena_cache != NULL) {
+      chunk = arena_cache;
+      arena_cache = chunk->next;
+      arena_cache_len--;
+    } else {
+      size_t csize = size > SHIM_ARENA_CHUNK_SIZE ? size : SHIM_ARENA_CHUNK_SIZE;
+      chunk = static_cast<shim_arena_chunk_s*>(
+        malloc(offset_of(shim_arena_chunk_s, data) + csize));
+
+      /* wrappers are handed out unchecked, like V8 we can only give up */
+      if (chunk == NULL) {
+        fprintf(stderr, "shim: arena out of memory (%lu bytes)\n",
+          static_cast<unsigned long>(csize));
+        abort();
+      }
+
+      chunk->size = csize;
+    }
+
+    chunk->used = 0;
+    chunk->next = arena->head;
+    arena->head = chunk;
+  }
+
+  void* ptr = reinterpret_cast<char*>(chunk->data) + chunk->used;
+  chunk->used += size;
+  return ptr;
+}
+
+
+void
+shim_arena_reset(shim_arena_s* arena)
+{
+  shim_arena_chunk_s* chunk = arena->head;
+
+  while (chunk != NULL) {
+    shim_arena_chunk_s* next = chunk->next;
+
+    if (chunk->size == SHIM_ARENA_CHUNK_SIZE
+        && arena_cache_len < SHIM_ARENA_CACHE_MAX) {
+      chunk->next = arena_cache;
+      arena_cache = chunk;
+      arena_cache_len++;
+    } else {
+      free(chunk);
+    }
+
+    chunk = next;
+  }
+
+  arena->head = NULL;
+}
+
+
+shim_val_s*
+shim_val_new(shim_ctx_s* ctx, SHIM__HANDLE_TYPE handle,
+  enum shim_type type = SHIM_TYPE_UNKNOWN)
+{
+  void* mem = shim_arena_alloc(ctx->allocs, sizeof(shim_val_s));
+  return new(mem) shim_val_s(handle, type);
+}
+
+
 void
 shim_context_cleanup(shim_ctx_s* ctx)
 {
+  shim_arena_reset(ctx->allocs);
 }
 
 
@@ -197,66 +300,22 @@ shim_call_func(shim_ctx_t* ctx, Local<Object> recv, Local<String> str, size_t ar
 }
 
 
-struct shim_fholder_s {
-  shim_func cfunc;
-  void* data;
-};
+size_t fholder_live = 0;
+size_t fholder_created = 0;
 
 
-#if NODE_VERSION_AT_LEAST(0, 11, 3)
-void
-Static(const FunctionCallbackInfo<Value>& args)
-#else
+/* the singletons carry no handle of their own */
 Handle<Value>
-Static(const Arguments& args)
-#endif
+ret_handle(shim_ctx_s* ctx, shim_val_s* val)
 {
-  String::Utf8Value fname(args.Callee()->GetName());
-  SHIM_DEBUG("SHIM ENTER %s\n", *fname);
-  SHIM_PROLOGUE(ctx);
-  SHIM_CTX(ctx);
-
-  Local<Value> data = args.Data();
-
-  assert(data->IsExternal());
-
-  Local<External> ext = data.As<External>();
-  shim_fholder_s* holder = reinterpret_cast<shim_fholder_s*>(ext->Value());
-  shim_func cfunc = holder->cfunc;
-
-  shim_args_s sargs;
-  sargs.argc = args.Length();
-  sargs.argv = NULL;
-  sargs.ret = shim_undefined();
-  sargs.self = new shim_val_s(args.This());
-  sargs.data = holder->data;
-
-  size_t argv_len = sizeof(shim_val_s*) * sargs.argc;
-
-  if (argv_len > 0)
-    sargs.argv = static_cast<shim_val_s**>(malloc(argv_len));
-
-  size_t i;
-
-  for (i = 0; i < sargs.argc; i++) {
-    sargs.argv[i] = new shim_val_s(args[i]);
-  }
-
-  SHIM_DEBUG("SHIM CALL %s\n", *fname);
-  if(!cfunc(&ctx, &sargs)) {
-    SHIM_DEBUG("SHIM ERROR %s\n", *fname);
-    /* the function failed do we need to do any more checking of exceptions? */
-  }
-  SHIM_DEBUG("SHIM EXIT %s\n", *fname);
-
   Handle<Value> ret;
 
-  if(sargs.ret != NULL) {
-    switch(sargs.ret->type) {
+  if(val != NULL) {
+    switch(val->type) {
       case SHIM_TYPE_UNDEFINED:
         SHIM_DEBUG("SHIM RET Undefined\n");
 #if NODE_VERSION_AT_LEAST(0, 11, 11)
-        ret = Undefined(ctx.isolate);
+        ret = Undefined(ctx->isolate);
 #else
         ret = Undefined();
 #endif
@@ -264,39 +323,86 @@ Static(const Arguments& args)
       case SHIM_TYPE_NULL:
         SHIM_DEBUG("SHIM RET Null\n");
 #if NODE_VERSION_AT_LEAST(0, 11, 11)
-        ret = Null(ctx.isolate);
+        ret = Null(ctx->isolate);
 #else
         ret = Null();
 #endif
         break;
       default:
-        ret = sargs.ret->handle;
+        ret = val->handle;
         SHIM_DEBUG("SHIM RET Value -- IsExternal %d\n", ret->IsExternal());
         break;
     }
   } else {
     SHIM_DEBUG("SHIM RET PTR NULL\n");
 #if NODE_VERSION_AT_LEAST(0, 11, 11)
-    ret = Null(ctx.isolate);
+    ret = Null(ctx->isolate);
 #else
     ret = Null();
 #endif
   }
 
-  for (i = 0; i < sargs.argc; i++) {
-    shim_value_release(sargs.argv[i]);
-  }
+  return ret;
+}
+
+
+#if NODE_VERSION_AT_LEAST(0, 11, 3)
+void
+Static(const FunctionCallbackInfo<Value>& args)
+#else
+Handle<Value>
+Static(const Arguments& args)
+#endif
+{
+  SHIM_PROLOGUE(ctx);
+  SHIM_CTX(ctx);
+
+  Local<Value> data = args.Data();
+
+  assert(data->IsExternal());
+
+  Local<External> ext = data.As<External>();
+  shim_fholder_s* holder = reinterpret_cast<shim_fholder_s*>(ext->Value());
+  shim_func cfunc = holder->cfunc;
+
+  SHIM_TRACE("SHIM ENTER %s\n", holder->name);
+
+  shim_args_s sargs;
+  sargs.argc = args.Length();
+  sargs.ret = shim_undefined();
+  sargs.self_val.handle = args.This();
+  sargs.self = &sargs.self_val;
+  sargs.data = holder->data;
+
+  sargs.ctx = &ctx;
+  sargs.info = &args;
+
+  size_t argv_len = sizeof(shim_val_s*) * sargs.argc;
+
+  /* the common case never leaves the stack */
+  if (sargs.argc <= SHIM_ARGS_INLINE)
+    sargs.argv = sargs.argv_inline;
+  else
+    sargs.argv = static_cast<shim_val_s**>(shim_arena_alloc(ctx.allocs,
+                                                            argv_len));
+
+  /* arguments are wrapped lazily by shim_args_at */
+  memset(sargs.argv, 0, argv_len);
 
-  shim_value_release(sargs.self);
+  if(!cfunc(&ctx, &sargs)) {
+    SHIM_TRACE("SHIM ERROR %s\n", holder->name);
+    /* the function failed do we need to do any more checking of exceptions? */
+  }
+  SHIM_TRACE("SHIM EXIT %s\n", holder->name);
 
-  if (argv_len > 0)
-    free(sargs.argv);
+  Handle<Value> ret = ret_handle(&ctx, sargs.ret);
 
+  /* self, argv and their wrappers all go back with the arena */
   shim_context_cleanup(&ctx);
 
   /* TODO sometimes things don't always propogate? */
   if (ctx_trycatch.HasCaught()) {
-    SHIM_DEBUG("SHIM THREW %s\n", *fname);
+    SHIM_TRACE("SHIM THREW %s\n", holder->name);
     ctx_trycatch.ReThrow();
 #if NODE_VERSION_AT_LEAST(0, 11, 3)
     return;
@@ -305,7 +411,7 @@ Static(const Arguments& args)
 #endif
   }
 
-  SHIM_DEBUG("SHIM LEAVING %s\n", *fname);
+  SHIM_TRACE("SHIM LEAVING %s\n", holder->name);
 #if NODE_VERSION_AT_LEAST(0, 11, 3)
   if (!ctx_trycatch.HasCaught())
     args.GetReturnValue().Set(Local<Value>(ret));
@@ -318,1710 +424,4961 @@ Static(const Arguments& args)
 #endif
 }
 
-#if NODE_VERSION_AT_LEAST(0, 11, 9)
-template <class TypeName>
-inline v8::Local<TypeName> StrongPersistentToLocal(
-    const v8::Persistent<TypeName>& persistent) {
-  return *reinterpret_cast<v8::Local<TypeName>*>(
-      const_cast<v8::Persistent<TypeName>*>(&persistent));
-}
-
-template <class TypeName>
-inline v8::Local<TypeName> WeakPersistentToLocal(
-    v8::Isolate* isolate,
-    const v8::Persistent<TypeName>& persistent) {
-  return v8::Local<TypeName>::New(isolate, persistent);
-}
-
-template <class TypeName>
-inline v8::Local<TypeName> PersistentToLocal(
-    v8::Isolate* isolate,
-    const v8::Persistent<TypeName>& persistent) {
-  if (persistent.IsWeak()) {
-    return WeakPersistentToLocal(isolate, persistent);
-  } else {
-    return StrongPersistentToLocal(persistent);
-  }
-}
+#if NODE_VERSION_AT_LEAST(0, 11, 3)
+void
+AccessorGet(Local<String> property, const PropertyCallbackInfo<Value>& info)
+#else
+Handle<Value>
+AccessorGet(Local<String> property, const AccessorInfo& info)
 #endif
-
-shim_bool_t
-shim_unpack_type(shim_ctx_s* ctx, shim_val_s* arg, shim_type_t type,
-  void* rval, shim_bool_t* allocated)
 {
-  *allocated = FALSE;
+  SHIM_PROLOGUE(ctx);
+  SHIM_CTX(ctx);
 
-  if (!shim_value_is(arg, type))
-    return FALSE;
+  /* the spec tables are static, the name never needs transcoding */
+  const shim_aspec_t* spec = static_cast<const shim_aspec_t*>(
+    info.Data().As<External>()->Value());
 
-  Local<Value> val = SHIM__TO_LOCAL(arg->handle);
+  shim_val_s self(info.This());
+  shim_val_s* rval = NULL;
+  Handle<Value> ret;
 
-  shim_val_s** srval = static_cast<shim_val_s**>(rval);
+  SHIM_TRACE("SHIM GET %s\n", spec->name);
 
-  switch(type) {
-    case SHIM_TYPE_BOOL:
-      *(shim_bool_t*)rval = val->BooleanValue();
-      break;
-    case SHIM_TYPE_INTEGER:
-      *(int64_t*)rval = val->IntegerValue();
-      break;
-    case SHIM_TYPE_UINT32:
-      *(uint32_t*)rval = val->Uint32Value();
-      break;
-    case SHIM_TYPE_INT32:
-      *(int32_t*)rval = val->Int32Value();
-      break;
-    case SHIM_TYPE_NUMBER:
-      *(double*)rval = val->NumberValue();
-      break;
-    case SHIM_TYPE_EXTERNAL:
-      *(void**)rval = shim_external_value(ctx, arg);
-      break;
-    case SHIM_TYPE_BUFFER:
-      *(char**)rval = shim_buffer_value(arg);
-      break;
-    case SHIM_TYPE_STRING:
-      *srval = shim_value_alloc();
-      *allocated = TRUE;
-      SHIM_DEBUG("allocating string at location %p with dest %p\n", srval, *srval);
-      (*srval)->handle = OBJ_TO_STRING(val);
-      (*srval)->type = SHIM_TYPE_STRING;
-      break;
-    case SHIM_TYPE_FUNCTION:
-      *srval = shim_value_alloc();
-      *allocated = TRUE;
-      (*srval)->handle = val;
-      (*srval)->type = SHIM_TYPE_FUNCTION;
-      break;
-    case SHIM_TYPE_UNDEFINED:
-    case SHIM_TYPE_NULL:
-    case SHIM_TYPE_DATE:
-    case SHIM_TYPE_ARRAY:
-    case SHIM_TYPE_OBJECT:
-    default:
-      return FALSE;
-      break;
-  }
+  if (spec->getter(&ctx, &self, spec->name, &rval, spec->data) && rval != NULL)
+    ret = ret_handle(&ctx, rval);
 
-  return TRUE;
-}
+  shim_context_cleanup(&ctx);
 
+  if (ctx_trycatch.HasCaught()) {
+    ctx_trycatch.ReThrow();
+#if NODE_VERSION_AT_LEAST(0, 11, 3)
+    return;
+#else
+    return Undefined();
+#endif
+  }
 
-Local<String>
-NewSymbol(shim_ctx_t* ctx, const char* data, size_t length = -1) {
-#if NODE_VERSION_AT_LEAST(0, 11, 11)
-        return String::NewFromUtf8(ctx->isolate,
-                        data,
-                        String::kInternalizedString,
-                        length);
+#if NODE_VERSION_AT_LEAST(0, 11, 3)
+  if (!ret.IsEmpty())
+    info.GetReturnValue().Set(Local<Value>(ret));
 #else
-        return String::NewSymbol(data);
+  return ctx_scope.Close(ret);
 #endif
 }
 
 
-extern "C"
-{
-extern const char *shim_modname;
-
-void shim_module_initialize_cpp(Handle<Object> exports,
-#if NODE_VERSION_AT_LEAST(0, 11, 10)
-                                Handle<Value> module,
-                                void* priv)
+void
+#if NODE_VERSION_AT_LEAST(0, 11, 3)
+AccessorSet(Local<String> property, Local<Value> value,
+  const PropertyCallbackInfo<void>& info)
 #else
-                                Handle<Value> module)
+AccessorSet(Local<String> property, Local<Value> value,
+  const AccessorInfo& info)
 #endif
 {
-  shim__undefined.type = SHIM_TYPE_UNDEFINED;
-  shim__null.type = SHIM_TYPE_NULL;
-
   SHIM_PROLOGUE(ctx);
   SHIM_CTX(ctx);
 
-  if (hidden_private.IsEmpty()) {
-    Handle<String> str = NewSymbol(&ctx, "shim_private");
+  const shim_aspec_t* spec = static_cast<const shim_aspec_t*>(
+    info.Data().As<External>()->Value());
+
+  shim_val_s self(info.This());
+  shim_val_s val(value);
+
+  SHIM_TRACE("SHIM SET %s\n", spec->name);
+
+  spec->setter(&ctx, &self, spec->name, &val, spec->data);
+  shim_context_cleanup(&ctx);
+
+  if (ctx_trycatch.HasCaught())
+    ctx_trycatch.ReThrow();
+}
+
+/* the interceptors are written once against both callback styles */
 #if NODE_VERSION_AT_LEAST(0, 11, 3)
-    hidden_private.Reset(ctx_isolate, str);
+#define SHIM__PROP_RET(T) void
+#define SHIM__PROP_INFO(T) const PropertyCallbackInfo<T>&
+#define SHIM__PROP_RETURN(T, ret)                                             \
+  if (ctx_trycatch.HasCaught()) {                                             \
+    ctx_trycatch.ReThrow();                                                   \
+    return;                                                                   \
+  }                                                                           \
+  if (!ret.IsEmpty())                                                         \
+    info.GetReturnValue().Set(Local<T>(ret));                                 \
+  return
+#define SHIM__PROP_DECLINE(T) return
 #else
-    hidden_private = Persistent<String>::New(str);
+#define SHIM__PROP_RET(T) Handle<T>
+#define SHIM__PROP_INFO(T) const AccessorInfo&
+#define SHIM__PROP_RETURN(T, ret)                                             \
+  if (ctx_trycatch.HasCaught()) {                                             \
+    ctx_trycatch.ReThrow();                                                   \
+    return Handle<T>();                                                       \
+  }                                                                           \
+  return ctx_scope.Close(ret)
+#define SHIM__PROP_DECLINE(T) return Handle<T>()
 #endif
-  }
 
-  shim_val_s sexport;
-  shim_val_s smodule;
 
-#if NODE_VERSION_AT_LEAST(0, 11, 3)
-  sexport.handle = Local<Value>::New(ctx.isolate, exports);
-  smodule.handle = Local<Value>::New(ctx.isolate, module);
+Handle<Integer>
+query_result(shim_ctx_s* ctx, int found)
+{
+  if (!found)
+    return Handle<Integer>();
+
+#if NODE_VERSION_AT_LEAST(0, 11, 11)
+  return Integer::New(ctx->isolate, v8::None);
 #else
-  sexport.handle = Local<Value>::New(exports);
-  smodule.handle = Local<Value>::New(module);
+  return Integer::New(v8::None);
 #endif
+}
 
-  if (!shim_initialize(&ctx, &sexport, &smodule)) {
-    if (!ctx_trycatch.HasCaught())
-      shim_throw_error(&ctx, "Failed to initialize module");
-  }
+
+Handle<Array>
+enum_result(shim_val_s* rval)
+{
+  if (rval == NULL)
+    return Handle<Array>();
+
+  return Local<Array>::Cast(SHIM__TO_LOCAL(rval->handle));
+}
+
+
+SHIM__PROP_RET(Value)
+IndexGet(uint32_t index, SHIM__PROP_INFO(Value) info)
+{
+  SHIM_PROLOGUE(ctx);
+  SHIM_CTX(ctx);
+
+  const shim_index_handler_t* handler = static_cast<shim_index_handler_t*>(
+    info.Data().As<External>()->Value());
+
+  shim_val_s self(info.This());
+  shim_val_s* rval = NULL;
+  Handle<Value> ret;
+
+  if (handler->getter(&ctx, &self, index, &rval, handler->data)
+      && rval != NULL)
+    ret = ret_handle(&ctx, rval);
 
   shim_context_cleanup(&ctx);
+  SHIM__PROP_RETURN(Value, ret);
 }
 
-NODE_MODULE(shim, shim_module_initialize_cpp);
 
-/* TODO abstract out so we don't need multiple temporaries */
+SHIM__PROP_RET(Value)
+IndexSet(uint32_t index, Local<Value> value, SHIM__PROP_INFO(Value) info)
+{
+  SHIM_PROLOGUE(ctx);
+  SHIM_CTX(ctx);
+
+  const shim_index_handler_t* handler = static_cast<shim_index_handler_t*>(
+    info.Data().As<External>()->Value());
+
+  shim_val_s self(info.This());
+  shim_val_s val(value);
+  Handle<Value> ret;
+
+  /* handing the value back tells V8 the store was intercepted */
+  if (handler->setter(&ctx, &self, index, &val, handler->data))
+    ret = value;
+
+  shim_context_cleanup(&ctx);
+  SHIM__PROP_RETURN(Value, ret);
+}
+
+
+SHIM__PROP_RET(Integer)
+IndexQuery(uint32_t index, SHIM__PROP_INFO(Integer) info)
+{
+  SHIM_PROLOGUE(ctx);
+  SHIM_CTX(ctx);
+
+  const shim_index_handler_t* handler = static_cast<shim_index_handler_t*>(
+    info.Data().As<External>()->Value());
+
+  shim_val_s self(info.This());
+  Handle<Integer> ret = query_result(&ctx,
+    handler->query(&ctx, &self, index, handler->data));
+
+  shim_context_cleanup(&ctx);
+  SHIM__PROP_RETURN(Integer, ret);
+}
+
+
+SHIM__PROP_RET(Array)
+IndexEnum(SHIM__PROP_INFO(Array) info)
+{
+  SHIM_PROLOGUE(ctx);
+  SHIM_CTX(ctx);
+
+  const shim_index_handler_t* handler = static_cast<shim_index_handler_t*>(
+    info.Data().As<External>()->Value());
+
+  shim_val_s self(info.This());
+  shim_val_s* rval = NULL;
+  Handle<Array> ret;
+
+  if (handler->enumerator(&ctx, &self, &rval, handler->data))
+    ret = enum_result(rval);
+
+  shim_context_cleanup(&ctx);
+  SHIM__PROP_RETURN(Array, ret);
+}
+
+
+/* names short enough are transcoded on the stack, longer ones on the heap */
+struct named_utf8_s {
+  char buf[SHIM_NAME_INLINE];
+  char* str;
+
+  named_utf8_s(Local<String> name) {
+    int len = name->Utf8Length();
+    str = len < SHIM_NAME_INLINE ? buf : new char[len + 1];
+    name->WriteUtf8(str, len + 1);
+  }
+
+  ~named_utf8_s() {
+    if (str != buf)
+      delete[] str;
+  }
+
+  char* operator*() {
+    return str;
+  }
+};
+
+
+/*
+ * Lets most declined names, like method lookups, skip the transcode and the
+ * whole prologue. Only as many characters as the prefix has are read out of
+ * V8, a prefix too long or not ASCII is left to named_declined_utf8.
+ */
+bool
+named_declined(const shim_named_handler_t* handler, Local<String> name)
+{
+  const char* prefix = handler->prefix;
+
+  if (prefix == NULL)
+    return false;
+
+  size_t len = 0;
+
+  for (; prefix[len] != '\0'; len++) {
+    if (len == SHIM_NAME_INLINE || (prefix[len] & 0x80) != 0)
+      return false;
+  }
+
+  if (static_cast<size_t>(name->Length()) < len)
+    return true;
+
+  uint16_t head[SHIM_NAME_INLINE + 1];
+  name->Write(head, 0, static_cast<int>(len));
+
+  for (size_t i = 0; i < len; i++) {
+    if (head[i] != static_cast<uint8_t>(prefix[i]))
+      return true;
+  }
+
+  return false;
+}
+
+
+bool
+named_declined_utf8(const shim_named_handler_t* handler, const char* name)
+{
+  return handler->prefix != NULL
+    && strncmp(name, handler->prefix, strlen(handler->prefix)) != 0;
+}
+
+
+SHIM__PROP_RET(Value)
+NamedGet(Local<String> property, SHIM__PROP_INFO(Value) info)
+{
+  const shim_named_handler_t* handler = static_cast<shim_named_handler_t*>(
+    info.Data().As<External>()->Value());
+
+  if (named_declined(handler, property))
+    SHIM__PROP_DECLINE(Value);
+
+  named_utf8_s name(property);
+
+  if (named_declined_utf8(handler, *name))
+    SHIM__PROP_DECLINE(Value);
+
+  SHIM_PROLOGUE(ctx);
+  SHIM_CTX(ctx);
+
+  shim_val_s self(info.This());
+  shim_val_s* rval = NULL;
+  Handle<Value> ret;
+
+  if (handler->getter(&ctx, &self, *name, &rval, handler->data)
+      && rval != NULL)
+    ret = ret_handle(&ctx, rval);
+
+  shim_context_cleanup(&ctx);
+  SHIM__PROP_RETURN(Value, ret);
+}
+
+
+SHIM__PROP_RET(Value)
+NamedSet(Local<String> property, Local<Value> value,
+  SHIM__PROP_INFO(Value) info)
+{
+  const shim_named_handler_t* handler = static_cast<shim_named_handler_t*>(
+    info.Data().As<External>()->Value());
+
+  if (named_declined(handler, property))
+    SHIM__PROP_DECLINE(Value);
+
+  named_utf8_s name(property);
+
+  if (named_declined_utf8(handler, *name))
+    SHIM__PROP_DECLINE(Value);
+
+  SHIM_PROLOGUE(ctx);
+  SHIM_CTX(ctx);
+
+  shim_val_s self(info.This());
+  shim_val_s val(value);
+  Handle<Value> ret;
+
+  if (handler->setter(&ctx, &self, *name, &val, handler->data))
+    ret = value;
+
+  shim_context_cleanup(&ctx);
+  SHIM__PROP_RETURN(Value, ret);
+}
+
+
+SHIM__PROP_RET(Integer)
+NamedQuery(Local<String> property, SHIM__PROP_INFO(Integer) info)
+{
+  const shim_named_handler_t* handler = static_cast<shim_named_handler_t*>(
+    info.Data().As<External>()->Value());
+
+  if (named_declined(handler, property))
+    SHIM__PROP_DECLINE(Integer);
+
+  named_utf8_s name(property);
+
+  if (named_declined_utf8(handler, *name))
+    SHIM__PROP_DECLINE(Integer);
+
+  SHIM_PROLOGUE(ctx);
+  SHIM_CTX(ctx);
+
+  shim_val_s self(info.This());
+  Handle<Integer> ret = query_result(&ctx,
+    handler->query(&ctx, &self, *name, handler->data));
+
+  shim_context_cleanup(&ctx);
+  SHIM__PROP_RETURN(Integer, ret);
+}
+
+
+SHIM__PROP_RET(Array)
+NamedEnum(SHIM__PROP_INFO(Array) info)
+{
+  SHIM_PROLOGUE(ctx);
+  SHIM_CTX(ctx);
+
+  const shim_named_handler_t* handler = static_cast<shim_named_handler_t*>(
+    info.Data().As<External>()->Value());
+
+  shim_val_s self(info.This());
+  shim_val_s* rval = NULL;
+  Handle<Array> ret;
+
+  if (handler->enumerator(&ctx, &self, &rval, handler->data))
+    ret = enum_result(rval);
+
+  shim_context_cleanup(&ctx);
+  SHIM__PROP_RETURN(Array, ret);
+}
+
+shim_val_s*
+shim_args_at(shim_args_s* args, size_t idx)
+{
+  assert(idx < args->argc);
+
+  shim_val_s* val = args->argv[idx];
+
+  if (val == NULL) {
+    SHIM__HANDLE_TYPE handle = (*args->info)[static_cast<int>(idx)];
+
+    if (idx < SHIM_ARGS_INLINE) {
+      val = &args->vals_inline[idx];
+      val->handle = handle;
+    } else {
+      val = shim_val_new(args->ctx, handle);
+    }
+
+    args->argv[idx] = val;
+  }
+
+  return val;
+}
+
+
+v8::Local<v8::Value>
+args_value(shim_args_s* args, size_t idx)
+{
+  return (*args->info)[static_cast<int>(idx)];
+}
+
+
+#if NODE_VERSION_AT_LEAST(0, 11, 9)
+template <class TypeName>
+inline v8::Local<TypeName> StrongPersistentToLocal(
+    const v8::Persistent<TypeName>& persistent) {
+  return *reinterpret_cast<v8::Local<TypeName>*>(
+      const_cast<v8::Persistent<TypeName>*>(&persistent));
+}
+
+template <class TypeName>
+inline v8::Local<TypeName> WeakPersistentToLocal(
+    v8::Isolate* isolate,
+    const v8::Persistent<TypeName>& persistent) {
+  return v8::Local<TypeName>::New(isolate, persistent);
+}
+
+template <class TypeName>
+inline v8::Local<TypeName> PersistentToLocal(
+    v8::Isolate* isolate,
+    const v8::Persistent<TypeName>& persistent) {
+  if (persistent.IsWeak()) {
+    return WeakPersistentToLocal(isolate, persistent);
+  } else {
+    return StrongPersistentToLocal(persistent);
+  }
+}
+#endif
+
+Local<String>
+NewSymbol(shim_ctx_t* ctx, const char* data, size_t length = -1) {
+#if NODE_VERSION_AT_LEAST(0, 11, 11)
+        return String::NewFromUtf8(ctx->isolate,
+                        data,
+                        String::kInternalizedString,
+                        length);
+#else
+        return String::NewSymbol(data);
+#endif
+}
+
+
+/*
+ * A format string compiled down to the types it unpacks, keyed by the
+ * contents of the format so each distinct format is only ever parsed once,
+ * the copy of the format follows the types
+ */
+struct shim_fmt_s {
+  uint32_t hash;
+  size_t len;
+  uint8_t types[1];
+};
+
+#define SHIM_FMT_CACHE_SIZE 256
+#define SHIM_FMT_CACHE_WAYS 4
+
+#define SHIM_FMT_STR(prog)                                                    \
+  reinterpret_cast<const char*>((prog)->types + (prog)->len)
+
+shim_fmt_s* fmt_cache[SHIM_FMT_CACHE_SIZE];
+
+/*
+ * The call sites seen so far by the address of their format, on a hit all
+ * that's left is checking the format didn't change since
+ */
+struct shim_fmt_site_s {
+  const char* fmt;
+  shim_fmt_s* prog;
+};
+
+#define SHIM_FMT_SITES 256
+
+/* Types an unpack copies to its stack before it needs the arena */
+#define SHIM_FMT_INLINE 16
+
+shim_fmt_site_s fmt_sites[SHIM_FMT_SITES];
+
+
+shim_type_t
+shim_fmt_type(char c)
+{
+  switch (c) {
+    case 'b': return SHIM_TYPE_BOOL;
+    case 'i': return SHIM_TYPE_INT32;
+    case 'u': return SHIM_TYPE_UINT32;
+    case 'l': return SHIM_TYPE_INTEGER;
+    case 'd': return SHIM_TYPE_NUMBER;
+    case 'e': return SHIM_TYPE_EXTERNAL;
+    case 'B': return SHIM_TYPE_BUFFER;
+    case 'A': return SHIM_TYPE_ARRAY_BUFFER;
+    case 'T': return SHIM_TYPE_TYPED_ARRAY;
+    case 's': return SHIM_TYPE_STRING;
+    case 'f': return SHIM_TYPE_FUNCTION;
+    default:  return SHIM_TYPE_UNKNOWN;
+  }
+}
+
+
+void
+shim_fmt_evict(shim_fmt_s* prog)
+{
+  for (size_t i = 0; i < SHIM_FMT_SITES; i++) {
+    if (fmt_sites[i].prog == prog) {
+      fmt_sites[i].fmt = NULL;
+      fmt_sites[i].prog = NULL;
+    }
+  }
+
+  free(prog);
+}
+
+
+const shim_fmt_s*
+shim_fmt_lookup(shim_ctx_s* ctx, const char* fmt)
+{
+  /* FNV-1a, formats are short so hashing is cheaper than the parse */
+  uint32_t hash = 2166136261u;
+  size_t len = 0;
+
+  for (; fmt[len] != '\0'; len++)
+    hash = (hash ^ static_cast<uint8_t>(fmt[len])) * 16777619u;
+
+  size_t base = hash & (SHIM_FMT_CACHE_SIZE - 1);
+  size_t slot = base;
+
+  for (size_t i = 0; i < SHIM_FMT_CACHE_WAYS; i++) {
+    size_t cur = (base + i) & (SHIM_FMT_CACHE_SIZE - 1);
+    shim_fmt_s* prog = fmt_cache[cur];
+
+    if (prog == NULL) {
+      slot = cur;
+      break;
+    }
+
+    if (prog->hash == hash && prog->len == len
+        && memcmp(SHIM_FMT_STR(prog), fmt, len) == 0)
+      return prog;
+  }
+
+  shim_fmt_s* nprog = static_cast<shim_fmt_s*>(
+    malloc(offset_of(shim_fmt_s, types) + len + len + 1));
+
+  if (nprog == NULL) {
+    fprintf(stderr, "shim: format cache out of memory (%lu bytes)\n",
+      static_cast<unsigned long>(len));
+    abort();
+  }
+
+  nprog->hash = hash;
+  nprog->len = len;
+  memcpy(nprog->types + len, fmt, len + 1);
+
+  for (size_t i = 0; i < len; i++) {
+    shim_type_t type = shim_fmt_type(fmt[i]);
+
+    if (type == SHIM_TYPE_UNKNOWN) {
+      shim_throw_error(ctx, "Invalid format character '%c' in \"%s\"", fmt[i],
+        fmt);
+      free(nprog);
+      return NULL;
+    }
+
+    nprog->types[i] = static_cast<uint8_t>(type);
+  }
+
+  if (fmt_cache[slot] != NULL)
+    shim_fmt_evict(fmt_cache[slot]);
+  fmt_cache[slot] = nprog;
+
+  return nprog;
+}
+
+
+const shim_fmt_s*
+shim_fmt_compile(shim_ctx_s* ctx, const char* fmt)
+{
+  shim_fmt_site_s* site = &fmt_sites[(reinterpret_cast<uintptr_t>(fmt) >> 3)
+                                     & (SHIM_FMT_SITES - 1)];
+  shim_fmt_s* prog = site->prog;
+
+  if (site->fmt == fmt && strcmp(SHIM_FMT_STR(prog), fmt) == 0)
+    return prog;
+
+  const shim_fmt_s* found = shim_fmt_lookup(ctx, fmt);
+
+  if (found != NULL) {
+    site->fmt = fmt;
+    site->prog = const_cast<shim_fmt_s*>(found);
+  }
+
+  return found;
+}
+
+
+/* ToInt32, casting a double that is out of range or not finite is undefined */
+inline int32_t
+number_to_int32(double d)
+{
+  if (!std::isfinite(d))
+    return 0;
+
+  d = std::fmod(d < 0 ? std::ceil(d) : std::floor(d), 4294967296.0);
+  if (d < 0)
+    d += 4294967296.0;
+
+  uint32_t u = static_cast<uint32_t>(d);
+
+  if (u < 0x80000000u)
+    return static_cast<int32_t>(u);
+  return static_cast<int32_t>(u - 0x80000000u) - 0x7fffffff - 1;
+}
+
+
+template <typename T, typename S>
+inline void
+typed_store(T* out, S val)
+{
+  *out = static_cast<T>(val);
+}
+
+
+inline void
+typed_store(int32_t* out, uint32_t val)
+{
+  *out = number_to_int32(val);
+}
+
+
+inline void
+typed_store(int32_t* out, float val)
+{
+  *out = number_to_int32(val);
+}
+
+
+inline void
+typed_store(int32_t* out, double val)
+{
+  *out = number_to_int32(val);
+}
+
+
+template <typename T, typename S>
+void
+typed_copy(T* out, const void* data, size_t len)
+{
+  const S* in = static_cast<const S*>(data);
+
+  for (size_t i = 0; i < len; i++)
+    typed_store(&out[i], in[i]);
+}
+
+
+/* typed arrays never touch V8 per element, at worst it's a widening loop */
+template <typename T>
+bool
+typed_convert(T* out, const void* data, shim_typed_t type, size_t len)
+{
+  switch (type) {
+    case SHIM_TYPED_INT8:
+      typed_copy<T, int8_t>(out, data, len);
+      break;
+    case SHIM_TYPED_UINT8:
+    case SHIM_TYPED_UINT8_CLAMPED:
+      typed_copy<T, uint8_t>(out, data, len);
+      break;
+    case SHIM_TYPED_INT16:
+      typed_copy<T, int16_t>(out, data, len);
+      break;
+    case SHIM_TYPED_UINT16:
+      typed_copy<T, uint16_t>(out, data, len);
+      break;
+    case SHIM_TYPED_INT32:
+      typed_copy<T, int32_t>(out, data, len);
+      break;
+    case SHIM_TYPED_UINT32:
+      typed_copy<T, uint32_t>(out, data, len);
+      break;
+    case SHIM_TYPED_FLOAT32:
+      typed_copy<T, float>(out, data, len);
+      break;
+    case SHIM_TYPED_FLOAT64:
+      typed_copy<T, double>(out, data, len);
+      break;
+    default:
+      return false;
+  }
+
+  return true;
+}
+
+
+inline void
+number_store(double* out, Local<Value> val)
+{
+  *out = val->NumberValue();
+}
+
+
+inline void
+number_store(int32_t* out, Local<Value> val)
+{
+  *out = val->Int32Value();
+}
+
+
+template <typename T>
+shim_bool_t
+array_to_numbers(shim_ctx_s* ctx, shim_val_s* arr, T* out, size_t len,
+  size_t* written, shim_typed_t same)
+{
+  size_t count;
+
+  if (shim_value_is(arr, SHIM_TYPE_TYPED_ARRAY)) {
+    shim_typed_t type;
+    void* data = shim_typed_array_value(arr, &count, &type);
+
+    if (count > len)
+      count = len;
+
+    if (type == same) {
+      memcpy(out, data, count * sizeof(T));
+    } else if (!typed_convert(out, data, type, count)) {
+      if (written != NULL)
+        *written = 0;
+      shim_throw_type_error(ctx, "Unsupported typed array");
+      return FALSE;
+    }
+
+    if (written != NULL)
+      *written = count;
+
+    return TRUE;
+  }
+
+  Local<Value> v = SHIM__TO_LOCAL(arr->handle);
+
+  if (!v->IsArray()) {
+    if (written != NULL)
+      *written = 0;
+    shim_throw_type_error(ctx, "Argument not an array");
+    return FALSE;
+  }
+
+  Local<Array> jsarr = v.As<Array>();
+  count = jsarr->Length();
+
+  if (count > len)
+    count = len;
+
+  /* no wrappers, and the locals are dropped a chunk at a time */
+  for (size_t base = 0; base < count; base += SHIM_ARRAY_CHUNK) {
+#if NODE_VERSION_AT_LEAST(0, 11, 9)
+    Isolate* chunk_isolate = ctx->isolate;
+#endif
+    SHIM_SCOPE(chunk)
+    size_t end = base + SHIM_ARRAY_CHUNK < count ? base + SHIM_ARRAY_CHUNK
+                                                 : count;
+
+    for (size_t i = base; i < end; i++) {
+      Local<Value> val = jsarr->Get(static_cast<uint32_t>(i));
+
+      if (!val->IsNumber()) {
+        if (written != NULL)
+          *written = i;
+        shim_throw_type_error(ctx, "Element %u not a number",
+          static_cast<unsigned>(i));
+        return FALSE;
+      }
+
+      number_store(&out[i], val);
+    }
+  }
+
+  if (written != NULL)
+    *written = count;
+
+  return TRUE;
+}
+
+
+template <typename T>
+shim_val_s*
+array_from_numbers(shim_ctx_s* ctx, const T* data, size_t len)
+{
+#if NODE_VERSION_AT_LEAST(0, 11, 11)
+  Local<Array> jsarr = Array::New(ctx->isolate, len);
+#else
+  Local<Array> jsarr = Array::New(len);
+#endif
+
+  for (size_t base = 0; base < len; base += SHIM_ARRAY_CHUNK) {
+#if NODE_VERSION_AT_LEAST(0, 11, 9)
+    Isolate* chunk_isolate = ctx->isolate;
+#endif
+    SHIM_SCOPE(chunk)
+    size_t end = base + SHIM_ARRAY_CHUNK < len ? base + SHIM_ARRAY_CHUNK : len;
+
+    for (size_t i = base; i < end; i++) {
+#if NODE_VERSION_AT_LEAST(0, 11, 11)
+      jsarr->Set(static_cast<uint32_t>(i), Number::New(ctx->isolate, data[i]));
+#else
+      jsarr->Set(static_cast<uint32_t>(i), Number::New(data[i]));
+#endif
+    }
+  }
+
+  return shim_val_new(ctx, jsarr);
+}
+
+
+extern "C"
+{
+extern const char *shim_modname;
+
+void shim_module_initialize_cpp(Handle<Object> exports,
+#if NODE_VERSION_AT_LEAST(0, 11, 10)
+                                Handle<Value> module,
+                                void* priv)
+#else
+                                Handle<Value> module)
+#endif
+{
+  shim__undefined.type = SHIM_TYPE_UNDEFINED;
+  shim__null.type = SHIM_TYPE_NULL;
+
+  const char* trace = getenv("SHIM_TRACE");
+  if (trace != NULL && *trace != '\0' && *trace != '0')
+    shim_tracing = TRUE;
+
+  SHIM_PROLOGUE(ctx);
+  SHIM_CTX(ctx);
+
+  if (hidden_private.IsEmpty()) {
+    Handle<String> str = NewSymbol(&ctx, "shim_private");
+    Handle<String> view = NewSymbol(&ctx, "shim_view");
+    Handle<String> ab = NewSymbol(&ctx, "ArrayBuffer");
+#if NODE_VERSION_AT_LEAST(0, 11, 3)
+    hidden_private.Reset(ctx_isolate, str);
+    hidden_view.Reset(ctx_isolate, view);
+    array_buffer_name.Reset(ctx_isolate, ab);
+#else
+    hidden_private = Persistent<String>::New(str);
+    hidden_view = Persistent<String>::New(view);
+    array_buffer_name = Persistent<String>::New(ab);
+#endif
+  }
+
+  shim_val_s sexport;
+  shim_val_s smodule;
+
+#if NODE_VERSION_AT_LEAST(0, 11, 3)
+  sexport.handle = Local<Value>::New(ctx.isolate, exports);
+  smodule.handle = Local<Value>::New(ctx.isolate, module);
+#else
+  sexport.handle = Local<Value>::New(exports);
+  smodule.handle = Local<Value>::New(module);
+#endif
+
+  if (!shim_initialize(&ctx, &sexport, &smodule)) {
+    if (!ctx_trycatch.HasCaught())
+      shim_throw_error(&ctx, "Failed to initialize module");
+  }
+
+  shim_context_cleanup(&ctx);
+}
+
+NODE_MODULE(shim, shim_module_initialize_cpp);
+
+/* TODO abstract out so we don't need multiple temporaries */
+
+/**
+ * \param val The value to check
+ * \param type The expected type
+ * \return TRUE or FALSE
+ *
+ * This doesn't coerce types, merely checks that the value is or isn't of the
+ * desired type
+ */
+shim_bool_t
+shim_value_is(shim_val_s* val, shim_type_t type)
+{
+  if (val->type == type)
+    return TRUE;
+
+  SHIM__HANDLE_TYPE obj(val->handle);
+
+  shim_bool_t ret = FALSE;
+
+  switch (type)
+  {
+    case SHIM_TYPE_OBJECT:
+      ret = obj->IsObject();
+      break;
+    case SHIM_TYPE_STRING:
+      ret = obj->IsString();
+      break;
+    case SHIM_TYPE_NUMBER:
+      ret = obj->IsNumber();
+      break;
+    case SHIM_TYPE_INTEGER:
+      /* TODO */
+      ret = obj->IsNumber();
+      break;
+    case SHIM_TYPE_INT32:
+      ret = obj->IsInt32();
+      break;
+    case SHIM_TYPE_UINT32:
+      ret = obj->IsUint32();
+      break;
+    case SHIM_TYPE_ARRAY:
+      ret = obj->IsArray();
+      break;
+    case SHIM_TYPE_BOOL:
+      ret = obj->IsBoolean();
+      break;
+    case SHIM_TYPE_UNDEFINED:
+      ret = obj->IsUndefined();
+      break;
+    case SHIM_TYPE_NULL:
+      ret = obj->IsNull();
+      break;
+    case SHIM_TYPE_EXTERNAL:
+      ret = obj->IsExternal();
+#if ! NODE_VERSION_AT_LEAST(0, 11, 3)
+      if (ret == FALSE && obj->IsObject()) {
+        Handle<Object> o = obj.As<Object>();
+
+        Local<Value> v = o->GetHiddenValue(hidden_private);
+        ret = v->IsExternal();
+      }
+#endif
+      break;
+    case SHIM_TYPE_DATE:
+      ret = obj->IsDate();
+      break;
+    case SHIM_TYPE_FUNCTION:
+      ret = obj->IsFunction();
+      break;
+    case SHIM_TYPE_BUFFER:
+      ret = node::Buffer::HasInstance(obj);
+      break;
+#if NODE_VERSION_AT_LEAST(0, 11, 5)
+    case SHIM_TYPE_ARRAY_BUFFER:
+      ret = obj->IsArrayBuffer();
+      break;
+    case SHIM_TYPE_TYPED_ARRAY:
+      ret = obj->IsTypedArray();
+      break;
+#else
+    /* node implements these itself, both are backed by external arrays */
+    case SHIM_TYPE_ARRAY_BUFFER:
+    case SHIM_TYPE_TYPED_ARRAY:
+      /* and so are Buffers, which are neither */
+      if (obj->IsObject()
+          && obj.As<Object>()->HasIndexedPropertiesInExternalArrayData()
+          && !node::Buffer::HasInstance(obj)) {
+        bool ab = obj.As<Object>()->GetConstructorName()->Equals(
+          array_buffer_name);
+        ret = type == SHIM_TYPE_ARRAY_BUFFER ? ab : !ab;
+      }
+      break;
+#endif
+    case SHIM_TYPE_UNKNOWN:
+    default:
+      ret = FALSE;
+      break;
+  }
+
+  if (ret)
+    val->type = type;
+
+  return ret;
+}
+
+/**
+ * \param ctx The currently executed context
+ * \param val The given value
+ * \param type The desired type
+ * \param rval The destination value
+ * \return TRUE or FALSE
+ *
+ * Attempts to coerce the given value into another type, if it fails to do so
+ * returns FALSE.
+ */
+shim_bool_t
+shim_value_to(shim_ctx_s* ctx, shim_val_s* val, shim_type_t type,
+  shim_val_s** srval)
+{
+  shim_val_s* rval = shim_val_new(ctx, val->handle);
+  *srval = rval;
+
+  if (val->type == type) {
+    rval->type = type;
+    rval->handle = val->handle;
+    return TRUE;
+  }
+
+
+  Local<Value> obj = SHIM__TO_LOCAL(val->handle);
+
+  switch (type) {
+    case SHIM_TYPE_UNDEFINED:
+#if NODE_VERSION_AT_LEAST(0, 11, 11)
+      rval->handle = Undefined(ctx->isolate);
+#else
+      rval->handle = Undefined();
+#endif
+      break;
+    case SHIM_TYPE_NULL:
+#if NODE_VERSION_AT_LEAST(0, 11, 11)
+      rval->handle = Null(ctx->isolate);
+#else
+      rval->handle = Null();
+#endif
+      break;
+    case SHIM_TYPE_BOOL:
+      rval->handle = obj->ToBoolean();
+      break;
+    case SHIM_TYPE_ARRAY:
+      rval->handle = OBJ_TO_ARRAY(obj);
+      break;
+    case SHIM_TYPE_OBJECT:
+      rval->handle = OBJ_TO_OBJECT(obj);
+      break;
+    case SHIM_TYPE_INTEGER:
+      /* TODO */
+      rval->handle = OBJ_TO_NUMBER(obj);
+      break;
+    case SHIM_TYPE_INT32:
+      rval->handle = OBJ_TO_INT32(obj);
+      break;
+    case SHIM_TYPE_UINT32:
+      rval->handle = OBJ_TO_UINT32(obj);
+      break;
+    case SHIM_TYPE_NUMBER:
+      rval->handle = OBJ_TO_NUMBER(obj);
+      break;
+    case SHIM_TYPE_EXTERNAL:
+#if NODE_VERSION_AT_LEAST(0, 11, 3)
+      rval->handle = OBJ_TO_EXTERNAL(obj);
+#else
+      if (obj->IsExternal())
+        rval->handle = obj.As<External>();
+      else
+        rval->handle = OBJ_TO_EXTERNAL(obj->ToObject()->GetHiddenValue(hidden_private));
+#endif
+      break;
+    case SHIM_TYPE_FUNCTION:
+      rval->handle = OBJ_TO_FUNCTION(obj);
+      break;
+    case SHIM_TYPE_STRING:
+      rval->handle = OBJ_TO_STRING(obj);
+    case SHIM_TYPE_UNKNOWN:
+    default:
+      return FALSE;
+  }
+
+  rval->type = type;
+  return TRUE;
+}
+
+
+shim_val_s*
+shim_undefined()
+{
+  return &shim__undefined;
+}
+
+
+shim_val_s*
+shim_null()
+{
+  return &shim__null;
+}
+
+/**
+ * \sa [memory](md_docs_memory.html)
+ *
+ * Allocate memory to hold an arbitrary handle.
+ */
+shim_val_s*
+shim_value_alloc(void)
+{
+  shim_val_s *val = new shim_val_s();
+  val->heap = true;
+  return (val);
+}
+
+/**
+ * \param val The given value
+ * \sa [memory](md_docs_memory.html)
+ *
+ * Presuming the value was not allocated for ::shim_args_s or being used for
+ * shim_args_set_rval() use this method to free the allocated memory
+ *
+ * Values handed out by the rest of the layer live in the context's arena and
+ * are reclaimed when the boundary call returns, releasing those is a no-op
+ */
+void
+shim_value_release(shim_val_s* val)
+{
+  if (val != NULL && val->heap && val->type != SHIM_TYPE_NULL
+      && val->type != SHIM_TYPE_UNDEFINED)
+    delete val;
+}
+
+
+/**
+ * \param ctx The currently executing context
+ * \param klass The constructor to be used (may be NULL)
+ * \param proto The prototype that should be used (may be NULL)
+ * \return A pointer to the created object, or NULL if the constructor threw
+ * \sa shim_value_release()
+ */
+shim_val_s*
+shim_obj_new(shim_ctx_s* ctx, shim_val_s* klass, shim_val_s* proto)
+{
+  Local<Object> obj;
+
+  if (klass != NULL) {
+    Local<Function> ctor = Local<Function>::Cast(SHIM__TO_LOCAL(klass->handle));
+    obj = ctor->NewInstance();
+
+    if (obj.IsEmpty())
+      return NULL;
+  } else {
+#if NODE_VERSION_AT_LEAST(0, 11, 9)
+    obj = Object::New(ctx->isolate);
+#else
+    obj = Object::New();
+#endif
+  }
+
+  if (proto != NULL)
+    obj->SetPrototype(proto->handle->ToObject());
+
+  return shim_val_new(ctx, obj);
+}
+
+
+/**
+ * \param ctx The currently executing context
+ * \param klass The given constructor
+ * \param argc The amount of arguments being passed
+ * \param argv The array of arguments to be passed
+ * \return The returned object
+ *
+ * Use this to instantiate an object with the given arguments
+ */
+shim_val_s*
+shim_obj_new_instance(shim_ctx_s* ctx, shim_val_s* klass, size_t argc,
+  shim_val_s** argv)
+{
+  Local<Function> ctor = Local<Function>::Cast(SHIM__TO_LOCAL(klass->handle));
+  SHIM__HANDLE_TYPE* jsargs = shim_vals_to_handles(ctx, argc, argv);
+
+  Local<Object> obj = ctor->NewInstance(argc, jsargs);
+
+  delete[] jsargs;
+
+  if (obj.IsEmpty())
+    return NULL;
+
+  return shim_val_new(ctx, obj);
+}
+
+/**
+ * \param ctx The currently executing context
+ * \param src The given value
+ * \return The new Local value representing the previous value
+ *
+ * Use this when you might want to create a Local of a persistent
+ * \sa persistents
+ */
+shim_val_s*
+shim_obj_clone(shim_ctx_s* ctx, shim_val_s* src)
+{
+#if NODE_VERSION_AT_LEAST(0, 11, 9)
+  Local<Value> dst = Local<Value>::New(ctx->isolate, src->handle);
+#else
+  Local<Value> dst = Local<Value>::New(src->handle);
+#endif
+  return shim_val_new(ctx, dst);
+}
+
+/**
+ * \param ctx The currently executing context
+ * \param val The given object
+ * \param name The name of the property
+ * \return TRUE if the object has the named property, otherwise FALSE
+ *
+ * Has the name
+ */
+shim_bool_t
+shim_obj_has_name(shim_ctx_s* ctx, shim_val_s* val, const char* name)
+{
+  Local<Object> obj = OBJ_TO_OBJECT(SHIM__TO_LOCAL(val->handle));
+  return obj->Has(NewSymbol(ctx, name)) ? TRUE : FALSE;
+}
+
+/**
+ * \param ctx The currently executing context
+ * \param val The given object
+ * \param id The id of the property
+ * \return TRUE if the object has the indexed property, otherwise FALSE
+ *
+ * Object can have ordered properties, or may be an array, use this to check
+ * if either exist.
+ */
+shim_bool_t
+shim_obj_has_id(shim_ctx_s* ctx, shim_val_s* val, uint32_t id)
+{
+  Local<Object> obj = OBJ_TO_OBJECT(SHIM__TO_LOCAL(val->handle));
+  return obj->Has(id) ? TRUE : FALSE;
+}
+
+/**
+ * \param ctx The currently executing context
+ * \param val The given object
+ * \param sym The symbol of the property
+ * \return TRUE if the object has the property, otherwise FALSE
+ *
+ * Use this if you are keeping a reference to a commonly used symbol name
+ * or are passed a value to lookup
+ */
+shim_bool_t
+shim_obj_has_sym(shim_ctx_s* ctx, shim_val_s* val, shim_val_s* sym)
+{
+  Local<Object> obj = OBJ_TO_OBJECT(SHIM__TO_LOCAL(val->handle));
+  return obj->Has(OBJ_TO_STRING(sym->handle));
+}
+
+/**
+ * \param ctx The currently executing context
+ * \param obj The given object
+ * \param name The name of the property
+ * \param val The value to be stored
+ * \return TRUE if the property was set, otherwise FALSE
+ */
+shim_bool_t
+shim_obj_set_prop_name(shim_ctx_s* ctx, shim_val_s* obj, const char* name,
+  shim_val_s* val)
+{
+  Local<Object> jsobj = OBJ_TO_OBJECT(SHIM__TO_LOCAL(obj->handle));
+  return jsobj->Set(NewSymbol(ctx, name), val->handle);
+}
+
+
+/**
+ * \param ctx The currently executing context
+ * \param obj The given object
+ * \param id The id of the property
+ * \param val The value to be stored
+ * \return TRUE if the property was set, otherwise FALSE
+ */
+shim_bool_t
+shim_obj_set_prop_id(shim_ctx_s* ctx, shim_val_s* obj, uint32_t id,
+  shim_val_s* val)
+{
+  Local<Object> jsobj = OBJ_TO_OBJECT(SHIM__TO_LOCAL(obj->handle));
+  return jsobj->Set(id, val->handle);
+}
+
+
+/**
+ * \param ctx The currently executing context
+ * \param obj The given object
+ * \param sym The symbol of the property
+ * \param val The value to be stored
+ * \return TRUE if the property was set, otherwise FALSE
+ */
+shim_bool_t
+shim_obj_set_prop_sym(shim_ctx_s* ctx, shim_val_s* obj, shim_val_s* sym,
+  shim_val_s* val)
+{
+  Local<Object> jsobj = OBJ_TO_OBJECT(SHIM__TO_LOCAL(obj->handle));
+  return jsobj->Set(sym->handle, val->handle);
+}
+
+void
+private_field_set(Local<Object> obj, void* data)
+{
+#if NODE_VERSION_AT_LEAST(0, 10, 0)
+  obj->SetAlignedPointerInInternalField(0, data);
+#else
+  obj->SetPointerInInternalField(0, data);
+#endif
+}
+
+
+void*
+private_field_get(Local<Object> obj)
+{
+#if NODE_VERSION_AT_LEAST(0, 10, 0)
+  return obj->GetAlignedPointerFromInternalField(0);
+#else
+  return obj->GetPointerFromInternalField(0);
+#endif
+}
+
+
+/* only its address matters, it tags the instances of our own classes */
+char class_marker;
+
+
+void
+private_field_init(Local<Object> obj)
+{
+  private_field_set(obj, NULL);
+#if NODE_VERSION_AT_LEAST(0, 10, 0)
+  obj->SetAlignedPointerInInternalField(1, &class_marker);
+#else
+  obj->SetPointerInInternalField(1, &class_marker);
+#endif
+}
+
+
+/*
+ * node's own wraps keep their native pointer in field 0 too, so an internal
+ * field alone doesn't mean the object is ours to write to
+ */
+bool
+private_field_owned(Local<Object> obj)
+{
+  if (obj->InternalFieldCount() != SHIM_CLASS_FIELDS)
+    return false;
+
+#if NODE_VERSION_AT_LEAST(0, 10, 0)
+  return obj->GetAlignedPointerFromInternalField(1) == &class_marker;
+#else
+  return obj->GetPointerFromInternalField(1) == &class_marker;
+#endif
+}
+
+/**
+ * \param ctx The currently executing context
+ * \param obj The given object
+ * \param data The data to be associated with the object
+ * \return TRUE if the data was able to be associated, otherwise FALSE
+ *
+ * Use this to associate C memory with a given object, which can be recalled
+ * at a later time with shim_obj_get_private()
+ *
+ * Instances of a ::shim_class_t keep the pointer in their internal field,
+ * any other object falls back to a hidden property.
+ *
+ * \sa shim_obj_make_weak()
+ */
+shim_bool_t
+shim_obj_set_private(shim_ctx_s* ctx, shim_val_s* obj, void* data)
+{
+  Local<Object> jsobj = OBJ_TO_OBJECT(SHIM__TO_LOCAL(obj->handle));
+
+  if (private_field_owned(jsobj)) {
+    private_field_set(jsobj, data);
+    return TRUE;
+  }
+
+#if NODE_VERSION_AT_LEAST(0, 11, 9)
+  Local<String> hp = PersistentToLocal<String>(ctx->isolate, hidden_private);
+  return jsobj->SetHiddenValue(hp, External::New(ctx->isolate, data));
+#else
+  return jsobj->SetHiddenValue(hidden_private, External::New(data));
+#endif
+}
+
+/**
+ * \param ctx The currently executing context
+ * \param recv The object to add the functions to
+ * \param funcs The null terminated array of functions
+ * \return TRUE if all functions were able to be added, otherwise FALSE
+ */
+shim_bool_t
+shim_obj_set_funcs(shim_ctx_s* ctx, shim_val_s* recv,
+  const shim_fspec_t* funcs)
+{
+  size_t i = 0;
+  shim_fspec_s cur = funcs[i];
+  while (cur.name != NULL) {
+    shim_val_s* func = shim_func_new(ctx, cur.cfunc, cur.nargs, cur.flags,
+      cur.name, cur.data);
+
+    if (!shim::shim_obj_set_prop_name(ctx, recv, cur.name, func))
+      return FALSE;
+
+    shim::shim_value_release(func);
+    cur = funcs[++i];
+  }
+
+  return TRUE;
+}
+
+v8::PropertyAttribute
+accessor_attrs(const shim_aspec_t* spec)
+{
+  return spec->setter != NULL ? v8::None : v8::ReadOnly;
+}
+
+/**
+ * \param ctx The currently executing context
+ * \param recv The object to add the accessors to
+ * \param accessors The null terminated array of accessors, which must outlive
+ * the object
+ * \return TRUE if all accessors were able to be added, otherwise FALSE
+ *
+ * The getter is only called when javascript reads the property, so a record
+ * can expose native fields without copying them all up front. Accessors
+ * without a setter are read only.
+ */
+shim_bool_t
+shim_obj_set_accessors(shim_ctx_s* ctx, shim_val_s* recv,
+  const shim_aspec_t* accessors)
+{
+  Local<Object> obj = OBJ_TO_OBJECT(SHIM__TO_LOCAL(recv->handle));
+
+  for (size_t i = 0; accessors[i].name != NULL; i++) {
+    const shim_aspec_t* spec = &accessors[i];
+#if NODE_VERSION_AT_LEAST(0, 11, 11)
+    Local<External> ext = External::New(ctx->isolate,
+      const_cast<shim_aspec_t*>(spec));
+#else
+    Local<External> ext = External::New(const_cast<shim_aspec_t*>(spec));
+#endif
+
+    if (!obj->SetAccessor(NewSymbol(ctx, spec->name), AccessorGet,
+          spec->setter != NULL ? AccessorSet : NULL, ext, v8::DEFAULT,
+          accessor_attrs(spec)))
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+/**
+ * \param ctx The currently executing context
+ * \param obj The the given object
+ * \param name The name of the property
+ * \param rval The actual value returned
+ * \return TRUE if object had the propert, otherwise FALSE
+ */
+shim_bool_t
+shim_obj_get_prop_name(shim_ctx_s* ctx, shim_val_s* obj, const char* name,
+  shim_val_s** rval)
+{
+  Local<Object> jsobj = OBJ_TO_OBJECT(SHIM__TO_LOCAL(obj->handle));
+  Local<Value> val = jsobj->Get(NewSymbol(ctx, name));
+  *rval = shim_val_new(ctx, val);
+  return TRUE;
+}
+
+
+/**
+ * \param ctx The currently executing context
+ * \param obj The the given object
+ * \param idx The id of the property
+ * \param rval The actual value returned
+ * \return TRUE if object had the propert, otherwise FALSE
+ */
+shim_bool_t
+shim_obj_get_prop_id(shim_ctx_s* ctx, shim_val_s* obj, uint32_t idx,
+  shim_val_s** rval)
+{
+  Local<Object> jsobj = OBJ_TO_OBJECT(SHIM__TO_LOCAL(obj->handle));
+  Local<Value> val = jsobj->Get(idx);
+  *rval = shim_val_new(ctx, val);
+  return TRUE;
+}
+
+
+/**
+ * \param ctx The currently executing context
+ * \param obj The the given object
+ * \param sym The symbol of the property
+ * \param rval The actual value returned
+ * \return TRUE if object had the propert, otherwise FALSE
+ */
+shim_bool_t
+shim_obj_get_prop_sym(shim_ctx_s* ctx, shim_val_s* obj, shim_val_s* sym,
+  shim_val_s** rval)
+{
+  Local<Object> jsobj = OBJ_TO_OBJECT(SHIM__TO_LOCAL(obj->handle));
+  Local<Value> val = jsobj->Get(sym->handle);
+  *rval = shim_val_new(ctx, val);
+  return TRUE;
+}
+
+
+Local<String>
+key_local(shim_key_s* key)
+{
+#if NODE_VERSION_AT_LEAST(0, 11, 9)
+  return StrongPersistentToLocal(key->handle);
+#else
+  return Local<String>(*key->handle);
+#endif
+}
+
+/**
+ * \param ctx The currently executing context
+ * \param name The property name
+ * \return The interned key
+ *
+ * Create keys once, for instance when the module is initialized, and use
+ * them with the `_key` variants of the property and call functions. Those
+ * skip the hash and string table lookup the `_name` variants do per call.
+ */
+shim_key_t*
+shim_key_new(shim_ctx_s* ctx, const char* name)
+{
+  shim_key_s* key = new shim_key_s;
+#if NODE_VERSION_AT_LEAST(0, 11, 9)
+  key->handle.Reset(ctx->isolate, NewSymbol(ctx, name));
+#else
+  key->handle = Persistent<String>::New(NewSymbol(ctx, name));
+#endif
+  return key;
+}
+
+/**
+ * \param key The key to dispose
+ */
+void
+shim_key_dispose(shim_key_s* key)
+{
+#if NODE_VERSION_AT_LEAST(0, 11, 9)
+  key->handle.Reset();
+#else
+  key->handle.Dispose();
+#endif
+  delete key;
+}
+
+/**
+ * \param ctx The currently executing context
+ * \param val The given object
+ * \param key The key of the property
+ * \return TRUE if the object has the property, otherwise FALSE
+ */
+shim_bool_t
+shim_obj_has_key(shim_ctx_s* ctx, shim_val_s* val, shim_key_s* key)
+{
+  Local<Object> obj = OBJ_TO_OBJECT(SHIM__TO_LOCAL(val->handle));
+  return obj->Has(key_local(key)) ? TRUE : FALSE;
+}
+
+/**
+ * \param ctx The currently executing context
+ * \param obj The given object
+ * \param key The key of the property
+ * \param val The value to be stored
+ * \return TRUE if the property was set, otherwise FALSE
+ */
+shim_bool_t
+shim_obj_set_prop_key(shim_ctx_s* ctx, shim_val_s* obj, shim_key_s* key,
+  shim_val_s* val)
+{
+  Local<Object> jsobj = OBJ_TO_OBJECT(SHIM__TO_LOCAL(obj->handle));
+  return jsobj->Set(key_local(key), val->handle);
+}
+
+/**
+ * \param ctx The currently executing context
+ * \param obj The the given object
+ * \param key The key of the property
+ * \param rval The actual value returned
+ * \return TRUE if object had the propert, otherwise FALSE
+ */
+shim_bool_t
+shim_obj_get_prop_key(shim_ctx_s* ctx, shim_val_s* obj, shim_key_s* key,
+  shim_val_s** rval)
+{
+  Local<Object> jsobj = OBJ_TO_OBJECT(SHIM__TO_LOCAL(obj->handle));
+  Local<Value> val = jsobj->Get(key_local(key));
+  *rval = shim_val_new(ctx, val);
+  return TRUE;
+}
+
+
+/**
+ * \param ctx The currently executing context
+ * \param names The property names in the order they should be defined
+ * \param count The number of names
+ * \return The shape
+ *
+ * Create shapes once and build every record of that layout with
+ * shim_shape_new_obj(). All the objects share one hidden class, and the
+ * names are interned up front so no string work happens per record.
+ */
+shim_shape_t*
+shim_shape_new(shim_ctx_s* ctx, const char** names, size_t count)
+{
+  shim_shape_s* shape = new shim_shape_s;
+  shape->keys = new shim_key_s[count];
+  shape->count = count;
+
+#if NODE_VERSION_AT_LEAST(0, 11, 11)
+  Local<ObjectTemplate> tmpl = ObjectTemplate::New(ctx->isolate);
+  Local<Value> undef = Undefined(ctx->isolate);
+#else
+  Local<ObjectTemplate> tmpl = ObjectTemplate::New();
+  Local<Value> undef = Local<Value>::New(Undefined());
+#endif
+
+  for (size_t i = 0; i < count; i++) {
+    Local<String> name = NewSymbol(ctx, names[i]);
+#if NODE_VERSION_AT_LEAST(0, 11, 9)
+    shape->keys[i].handle.Reset(ctx->isolate, name);
+#else
+    shape->keys[i].handle = Persistent<String>::New(name);
+#endif
+    tmpl->Set(name, undef);
+  }
+
+#if NODE_VERSION_AT_LEAST(0, 11, 9)
+  shape->tmpl.Reset(ctx->isolate, tmpl);
+#else
+  shape->tmpl = Persistent<ObjectTemplate>::New(tmpl);
+#endif
+
+  return shape;
+}
+
+/**
+ * \param shape The shape to dispose
+ */
+void
+shim_shape_dispose(shim_shape_s* shape)
+{
+  for (size_t i = 0; i < shape->count; i++) {
+#if NODE_VERSION_AT_LEAST(0, 11, 9)
+    shape->keys[i].handle.Reset();
+#else
+    shape->keys[i].handle.Dispose();
+#endif
+  }
+
+#if NODE_VERSION_AT_LEAST(0, 11, 9)
+  shape->tmpl.Reset();
+#else
+  shape->tmpl.Dispose();
+#endif
+
+  delete[] shape->keys;
+  delete shape;
+}
+
+/**
+ * \param ctx The currently executing context
+ * \param shape The shape of the object
+ * \param vals One value per key in the order the shape was declared, a NULL
+ * entry leaves that property undefined
+ * \return The new object
+ */
+shim_val_s*
+shim_shape_new_obj(shim_ctx_s* ctx, shim_shape_s* shape, shim_val_s** vals)
+{
+#if NODE_VERSION_AT_LEAST(0, 11, 9)
+  Local<ObjectTemplate> tmpl = StrongPersistentToLocal(shape->tmpl);
+#else
+  Local<ObjectTemplate> tmpl = Local<ObjectTemplate>(*shape->tmpl);
+#endif
+  Local<Object> obj = tmpl->NewInstance();
+
+  for (size_t i = 0; i < shape->count; i++) {
+    if (vals[i] != NULL)
+      obj->Set(key_local(&shape->keys[i]), ret_handle(ctx, vals[i]));
+  }
+
+  return shim_val_new(ctx, obj);
+}
+
+/**
+ * \param ctx The currently executing context
+ * \param fields The fields to extract, terminated by SHIM_FIELD_END
+ * \return The compiled fields
+ *
+ * Fields map a property to a struct member by type:
+ *
+ *  - SHIM_TYPE_BOOL to a shim_bool_t
+ *  - SHIM_TYPE_INT32 to an int32_t, SHIM_TYPE_UINT32 to a uint32_t
+ *  - SHIM_TYPE_INTEGER to an int64_t, SHIM_TYPE_NUMBER to a double
+ *  - SHIM_TYPE_EXTERNAL to a void*, SHIM_TYPE_BUFFER to a char*
+ *  - SHIM_TYPE_ARRAY_BUFFER and SHIM_TYPE_TYPED_ARRAY to a
+ *    ::shim_buffer_view_t
+ *  - anything else to a ::shim_val_t* valid for the rest of the call
+ */
+shim_extract_t*
+shim_extract_new(shim_ctx_s* ctx, const shim_field_t* fields)
+{
+  size_t count = 0;
+
+  while (fields[count].name != NULL)
+    count++;
+
+  shim_extract_s* extract = new shim_extract_s;
+  extract->fields = new shim_field_t[count];
+  extract->keys = new shim_key_s[count];
+  extract->count = count;
+
+  for (size_t i = 0; i < count; i++) {
+    extract->fields[i] = fields[i];
+#if NODE_VERSION_AT_LEAST(0, 11, 9)
+    extract->keys[i].handle.Reset(ctx->isolate, NewSymbol(ctx, fields[i].name));
+#else
+    extract->keys[i].handle = Persistent<String>::New(
+      NewSymbol(ctx, fields[i].name));
+#endif
+  }
+
+  return extract;
+}
+
+/**
+ * \param extract The compiled fields to dispose
+ */
+void
+shim_extract_dispose(shim_extract_s* extract)
+{
+  for (size_t i = 0; i < extract->count; i++) {
+#if NODE_VERSION_AT_LEAST(0, 11, 9)
+    extract->keys[i].handle.Reset();
+#else
+    extract->keys[i].handle.Dispose();
+#endif
+  }
+
+  delete[] extract->keys;
+  delete[] extract->fields;
+  delete extract;
+}
+
+/**
+ * \param ctx The currently executing context
+ * \param obj The object to read
+ * \param extract The compiled fields
+ * \param dest The struct to write into
+ * \return TRUE if every present property had the right type, otherwise
+ * FALSE and an exception is set
+ *
+ * Properties that are missing or undefined leave their member untouched, so
+ * fill dest with defaults first. Primitives are written straight into the
+ * struct without wrapping them.
+ */
+shim_bool_t
+shim_obj_extract(shim_ctx_s* ctx, shim_val_s* obj, shim_extract_s* extract,
+  void* dest)
+{
+  Local<Object> jsobj = OBJ_TO_OBJECT(SHIM__TO_LOCAL(obj->handle));
+  char* base = static_cast<char*>(dest);
+
+  for (size_t i = 0; i < extract->count; i++) {
+    const shim_field_t* field = &extract->fields[i];
+    Local<Value> val = jsobj->Get(key_local(&extract->keys[i]));
+
+    if (val->IsUndefined())
+      continue;
+
+    /* the wrapper only lives for this iteration, never off the stack */
+    shim_val_s arg(val);
+    void* member = base + field->offset;
+
+    switch (field->type) {
+      case SHIM_TYPE_NULL:
+      case SHIM_TYPE_DATE:
+      case SHIM_TYPE_ARRAY:
+      case SHIM_TYPE_OBJECT:
+        if (!shim_value_is(&arg, field->type))
+          break;
+        *static_cast<shim_val_s**>(member) = shim_val_new(ctx, val,
+          field->type);
+        continue;
+      default:
+        if (shim_unpack_type(ctx, &arg, field->type, member))
+          continue;
+        break;
+    }
+
+    shim_throw_type_error(ctx, "Property %s not of type %s", field->name,
+      shim_type_str(field->type));
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/**
+ * \param ctx The currently executing context
+ * \param obj The the given object
+ * \param data The actual data
+ * \return TRUE if the object had hidden data, otherwise FALSE
+ */
+shim_bool_t
+shim_obj_get_private(shim_ctx_s* ctx, shim_val_s* obj, void** data)
+{
+  Local<Object> jsobj = OBJ_TO_OBJECT(SHIM__TO_LOCAL(obj->handle));
+
+  /* a couple of loads for class instances, no property lookup */
+  if (private_field_owned(jsobj)) {
+    *data = private_field_get(jsobj);
+    return TRUE;
+  }
+
+#if NODE_VERSION_AT_LEAST(0, 11, 9)
+  Local<String> hp = PersistentToLocal<String>(ctx->isolate, hidden_private);
+  Local<Value> ext = jsobj->GetHiddenValue(hp);
+#else
+  Local<Value> ext = jsobj->GetHiddenValue(hidden_private);
+#endif
+  *data = ext.As<External>()->Value();
+  return TRUE;
+}
+
+/**
+ * \param ctx The currently executing context
+ * \param val The the given object
+ * \return The created persistent
+ */
+shim_persistent_t*
+shim_persistent_new(shim_ctx_s* ctx, shim_val_s* val)
+{
+  shim_persistent_s *p = new shim_persistent_s;
+#if NODE_VERSION_AT_LEAST(0, 11, 9)
+  p->handle.Reset(ctx->isolate, val->handle);
+#else
+  p->handle = Persistent<Value>::New(val->handle);
+#endif
+  return p;
+}
+
+/**
+ * \param val The persistent to dispose
+ */
+void
+shim_persistent_dispose(shim_persistent_s* val)
+{
+#if NODE_VERSION_AT_LEAST(0, 11, 9)
+  val->handle.Reset();
+#else
+  val->handle.Dispose();
+#endif
+  delete val;
+}
+
+
+shim_bool_t
+shim_persistent_to_val(shim_ctx_s* ctx, shim_persistent_s* pval, shim_val_s** val)
+{
+#if NODE_VERSION_AT_LEAST(0, 11, 9)
+  *val = shim_val_new(ctx, PersistentToLocal(ctx->isolate, pval->handle));
+#else
+  *val = shim_val_new(ctx, Local<Value>::New(pval->handle));
+#endif
+  return TRUE;
+}
+
+#if NODE_VERSION_AT_LEAST(0, 11, 11)
+void
+common_weak_cb(const v8::WeakCallbackData<Value, weak_baton_t>& data)
+{
+  SHIM_PROLOGUE(ctx);
+  SHIM_CTX(ctx);
+
+  weak_baton_t* baton = data.GetParameter();
+  baton->weak_cb(&ctx, baton->persistent, baton->data);
+  shim_context_cleanup(&ctx);
+  delete baton;
+}
+#else
+void
+#if NODE_VERSION_AT_LEAST(0, 11, 3)
+common_weak_cb(Isolate* iso, Persistent<Value>* pobj, weak_baton_t* baton)
+{
+#else
+common_weak_cb(Persistent<Value> obj, void* data)
+{
+  weak_baton_t* baton = static_cast<weak_baton_t*>(data);
+#endif
+
+  SHIM_PROLOGUE(ctx);
+  SHIM_CTX(ctx);
+
+  baton->weak_cb(&ctx, baton->persistent, baton->data);
+  shim_context_cleanup(&ctx);
+  delete baton;
+}
+#endif
+
+/**
+ * \param ctx Currently executing context
+ * \param val Persistent to make weak
+ * \param data Arbitrary data to pass to the weak_cb
+ * \param weak_cb Callback that will be called when the object is about to be
+ * free
+ */
+void
+shim_obj_make_weak(shim_ctx_s* ctx, shim_persistent_s* val, void* data,
+  shim_weak_cb weak_cb)
+{
+  weak_baton_s *baton = new weak_baton_t;
+  baton->weak_cb = weak_cb;
+  baton->data = data;
+  baton->persistent = val;
+
+#if NODE_VERSION_AT_LEAST(0, 11, 11)
+  val->handle.SetWeak(baton, common_weak_cb);
+#else
+  val->handle.MakeWeak(baton, common_weak_cb);
+#endif
+}
+
+/**
+ * \param val The given persistent
+ */
+void
+shim_obj_clear_weak(shim_persistent_s* val)
+{
+  val->handle.ClearWeak();
+}
+
+void
+fholder_free(shim_fholder_s* holder)
+{
+  free(holder->name);
+  delete holder;
+  fholder_live--;
+}
+
+
+#if NODE_VERSION_AT_LEAST(0, 11, 13)
+void
+fholder_weak_cb(const v8::WeakCallbackData<Value, shim_fholder_s>& data)
+{
+  shim_fholder_s* holder = data.GetParameter();
+  holder->fn.Reset();
+  fholder_free(holder);
+}
+#endif
+
+shim_fholder_s*
+fholder_new(shim_func cfunc, int32_t flags, const char* name, void* hint)
+{
+  shim_fholder_s* holder = new shim_fholder_s;
+  holder->cfunc = cfunc;
+  holder->data = hint;
+  holder->name = strdup(name);
+  holder->flags = flags;
+  return holder;
+}
+
+
+Local<FunctionTemplate>
+fholder_template(shim_ctx_s* ctx, shim_fholder_s* holder,
+  Handle<Signature> sig = Handle<Signature>())
+{
+#if NODE_VERSION_AT_LEAST(0, 11, 11)
+  Local<External> ext = External::New(ctx->isolate, reinterpret_cast<void*>(holder));
+  return FunctionTemplate::New(ctx->isolate, shim::Static, ext, sig);
+#else
+  Local<External> ext = External::New(reinterpret_cast<void*>(holder));
+  return FunctionTemplate::New(shim::Static, ext, sig);
+#endif
+}
+
+#if ! NODE_VERSION_AT_LEAST(0, 11, 13)
+shim_ftmpl_s* ftmpl_cache[SHIM_FUNC_TMPL_BUCKETS];
+
+
+Local<FunctionTemplate>
+ftmpl_lookup(shim_ctx_s* ctx, shim_func cfunc, int32_t flags,
+  const char* name, void* hint)
+{
+  uintptr_t key = reinterpret_cast<uintptr_t>(cfunc)
+                ^ reinterpret_cast<uintptr_t>(hint) * 31
+                ^ static_cast<uintptr_t>(flags);
+  shim_ftmpl_s** bucket = &ftmpl_cache[key % SHIM_FUNC_TMPL_BUCKETS];
+
+  for (shim_ftmpl_s* cur = *bucket; cur != NULL; cur = cur->next) {
+    shim_fholder_s* holder = cur->holder;
+
+    if (holder->cfunc == cfunc && holder->flags == flags
+        && holder->data == hint && strcmp(holder->name, name) == 0) {
+#if NODE_VERSION_AT_LEAST(0, 11, 9)
+      return PersistentToLocal(ctx->isolate, cur->tmpl);
+#else
+      return Local<FunctionTemplate>::New(cur->tmpl);
+#endif
+    }
+  }
+
+  fholder_live++;
+  fholder_created++;
+
+  shim_ftmpl_s* entry = new shim_ftmpl_s;
+  entry->holder = fholder_new(cfunc, flags, name, hint);
+
+  Local<FunctionTemplate> ft = fholder_template(ctx, entry->holder);
+
+#if NODE_VERSION_AT_LEAST(0, 11, 9)
+  entry->tmpl.Reset(ctx->isolate, ft);
+#else
+  entry->tmpl = Persistent<FunctionTemplate>::New(ft);
+#endif
+
+  entry->next = *bucket;
+  *bucket = entry;
+
+  return ft;
+}
+#endif
+
+/**
+ * \param ctx Currently executing context
+ * \param cfunc The function pointer to be executed
+ * \param argc The number of arguments the function takes
+ * \param flags The flags for the function
+ * \param name The name of the function
+ * \param hint Arbitrary data to keep associated with the function
+ * \return The wrapped function
+ *
+ * From node 0.11.13 every call creates a new function, so properties set on
+ * one never show up on another, and its holder is freed once the function is
+ * collected.
+ *
+ * Before that V8 keeps every function instantiated from a template for the
+ * life of the context, so the function and its holder are never freed.
+ * Instead the template is cached, and calls with the same cfunc, flags, data
+ * and name return the same function.
+ */
+shim_val_s*
+shim_func_new(shim_ctx_s* ctx, shim_func cfunc, size_t argc, int32_t flags,
+  const char* name, void* hint)
+{
+#if NODE_VERSION_AT_LEAST(0, 11, 13)
+  fholder_live++;
+  fholder_created++;
+
+  shim_fholder_s* holder = fholder_new(cfunc, flags, name, hint);
+
+  /* unlike GetFunction() this skips the context's instantiation cache */
+  Local<External> ext = External::New(ctx->isolate, holder);
+  Local<Function> fh = Function::New(ctx->isolate, shim::Static, ext);
+  fh->SetName(NewSymbol(ctx, name));
+
+  holder->fn.Reset(ctx->isolate, fh);
+  holder->fn.SetWeak(holder, fholder_weak_cb);
+#else
+  Local<Function> fh = ftmpl_lookup(ctx, cfunc, flags, name, hint)
+    ->GetFunction();
+  fh->SetName(NewSymbol(ctx, name));
+#endif
+
+  return shim_val_new(ctx, fh);
+}
+
+/*
+ * instances start out with no private data, whether or not there's a ctor,
+ * and without new there is no instance whose fields we could set up
+ */
+#if NODE_VERSION_AT_LEAST(0, 11, 3)
+void
+ClassCtor(const FunctionCallbackInfo<Value>& args)
+#else
+Handle<Value>
+ClassCtor(const Arguments& args)
+#endif
+{
+  Local<External> ext = args.Data().As<External>();
+  shim_fholder_s* holder = reinterpret_cast<shim_fholder_s*>(ext->Value());
+
+  if (!args.IsConstructCall()) {
+    SHIM_PROLOGUE(ctx);
+    SHIM_CTX(ctx);
+    shim_throw_type_error(&ctx,
+      "Class constructor %s cannot be invoked without 'new'", holder->name);
+    shim_context_cleanup(&ctx);
+    ctx_trycatch.ReThrow();
+#if NODE_VERSION_AT_LEAST(0, 11, 3)
+    return;
+#else
+    return Undefined();
+#endif
+  }
+
+  private_field_init(args.This());
+
+#if NODE_VERSION_AT_LEAST(0, 11, 3)
+  if (holder->cfunc != NULL)
+    Static(args);
+#else
+  if (holder->cfunc != NULL)
+    return Static(args);
+
+  return args.This();
+#endif
+}
+
+
+Local<FunctionTemplate>
+class_template(shim_ctx_s* ctx, shim_class_s* klass)
+{
+#if NODE_VERSION_AT_LEAST(0, 11, 9)
+  return PersistentToLocal(ctx->isolate, klass->tmpl);
+#else
+  return Local<FunctionTemplate>::New(klass->tmpl);
+#endif
+}
+
+/**
+ * \param ctx Currently executing context
+ * \param name The name of the class
+ * \param ctor The function called when javascript constructs an instance,
+ * may be NULL
+ * \param argc The number of arguments the constructor takes
+ * \param data Arbitrary data to keep associated with the constructor
+ * \return The class
+ *
+ * Instances are created from a single template with two internal fields,
+ * the private pointer and a marker telling them apart from other wrapped
+ * objects, so V8 gives them all the same hidden class. Calling the
+ * constructor without new throws a TypeError. The class is never freed,
+ * define it once when the module is initialized.
+ */
+shim_class_t*
+shim_class_new(shim_ctx_s* ctx, const char* name, shim_func ctor, size_t argc,
+  void* data)
+{
+  shim_class_s* klass = new shim_class_s;
+  klass->ctor = fholder_new(ctor, 0, name, data);
+
+#if NODE_VERSION_AT_LEAST(0, 11, 11)
+  Local<External> ext = External::New(ctx->isolate, klass->ctor);
+  Local<FunctionTemplate> ft = FunctionTemplate::New(ctx->isolate, ClassCtor,
+    ext);
+#else
+  Local<External> ext = External::New(klass->ctor);
+  Local<FunctionTemplate> ft = FunctionTemplate::New(ClassCtor, ext);
+#endif
+
+  ft->SetClassName(NewSymbol(ctx, name));
+  ft->InstanceTemplate()->SetInternalFieldCount(SHIM_CLASS_FIELDS);
+
+#if NODE_VERSION_AT_LEAST(0, 11, 9)
+  klass->tmpl.Reset(ctx->isolate, ft);
+#else
+  klass->tmpl = Persistent<FunctionTemplate>::New(ft);
+#endif
+
+  return klass;
+}
+
+/**
+ * \param ctx Currently executing context
+ * \param klass The class
+ * \param funcs The methods to add, terminated by SHIM_FS_END
+ * \return TRUE
+ *
+ * Methods must be added before the constructor is first retrieved. They
+ * carry the class as their signature, so V8 rejects calls on anything that
+ * isn't an instance before they reach C.
+ */
+shim_bool_t
+shim_class_set_funcs(shim_ctx_s* ctx, shim_class_t* klass,
+  const shim_fspec_t* funcs)
+{
+  Local<FunctionTemplate> ft = class_template(ctx, klass);
+  Local<ObjectTemplate> proto = ft->PrototypeTemplate();
+#if NODE_VERSION_AT_LEAST(0, 11, 11)
+  Local<Signature> sig = Signature::New(ctx->isolate, ft);
+#else
+  Local<Signature> sig = Signature::New(ft);
+#endif
+
+  for (size_t i = 0; funcs[i].name != NULL; i++) {
+    const shim_fspec_t* cur = &funcs[i];
+    /* lives as long as the class */
+    shim_fholder_s* holder = fholder_new(cur->cfunc, cur->flags, cur->name,
+      cur->data);
+    proto->Set(NewSymbol(ctx, cur->name), fholder_template(ctx, holder, sig));
+  }
+
+  return TRUE;
+}
+
+/**
+ * \param ctx Currently executing context
+ * \param klass The class
+ * \param accessors The null terminated array of accessors, which must outlive
+ * the class
+ * \return TRUE
+ *
+ * Accessors are installed on the instance template, so every instance shares
+ * them without any per object setup. Like methods they must be added before
+ * the constructor is first retrieved.
+ */
+shim_bool_t
+shim_class_set_accessors(shim_ctx_s* ctx, shim_class_t* klass,
+  const shim_aspec_t* accessors)
+{
+  Local<ObjectTemplate> inst = class_template(ctx, klass)->InstanceTemplate();
+
+  for (size_t i = 0; accessors[i].name != NULL; i++) {
+    const shim_aspec_t* spec = &accessors[i];
+#if NODE_VERSION_AT_LEAST(0, 11, 11)
+    Local<External> ext = External::New(ctx->isolate,
+      const_cast<shim_aspec_t*>(spec));
+#else
+    Local<External> ext = External::New(const_cast<shim_aspec_t*>(spec));
+#endif
+
+    inst->SetAccessor(NewSymbol(ctx, spec->name), AccessorGet,
+      spec->setter != NULL ? AccessorSet : NULL, ext, v8::DEFAULT,
+      accessor_attrs(spec));
+  }
+
+  return TRUE;
+}
+
+/**
+ * \param ctx Currently executing context
+ * \param klass The class
+ * \param handler The callbacks, which must outlive the class
+ * \return TRUE, otherwise FALSE if the handler has no getter
+ *
+ * Lets javascript index into a native collection on demand rather than
+ * copying it into an Array up front, enumeration is answered from C too.
+ */
+shim_bool_t
+shim_class_set_indexed(shim_ctx_s* ctx, shim_class_t* klass,
+  const shim_index_handler_t* handler)
+{
+  if (handler->getter == NULL)
+    return FALSE;
+
+  Local<ObjectTemplate> inst = class_template(ctx, klass)->InstanceTemplate();
+  void* data = const_cast<shim_index_handler_t*>(handler);
+#if NODE_VERSION_AT_LEAST(0, 11, 11)
+  Local<External> ext = External::New(ctx->isolate, data);
+#else
+  Local<External> ext = External::New(data);
+#endif
+
+  inst->SetIndexedPropertyHandler(IndexGet,
+    handler->setter != NULL ? IndexSet : NULL,
+    handler->query != NULL ? IndexQuery : NULL,
+    NULL,
+    handler->enumerator != NULL ? IndexEnum : NULL,
+    ext);
+
+  return TRUE;
+}
+
+/**
+ * \param ctx Currently executing context
+ * \param klass The class
+ * \param handler The callbacks, which must outlive the class
+ * \return TRUE, otherwise FALSE if the handler has no getter
+ *
+ * Like shim_class_set_indexed() for names. Every access to a named property
+ * of an instance, method lookups included, reaches the interceptor first, so
+ * give the handler a prefix when it only answers some names. Names without
+ * it are declined before any scope is set up. Names are transcoded for C on
+ * the stack when short, prefer accessors for a fixed set of properties.
+ */
+shim_bool_t
+shim_class_set_named(shim_ctx_s* ctx, shim_class_t* klass,
+  const shim_named_handler_t* handler)
+{
+  if (handler->getter == NULL)
+    return FALSE;
+
+  Local<ObjectTemplate> inst = class_template(ctx, klass)->InstanceTemplate();
+  void* data = const_cast<shim_named_handler_t*>(handler);
+#if NODE_VERSION_AT_LEAST(0, 11, 11)
+  Local<External> ext = External::New(ctx->isolate, data);
+#else
+  Local<External> ext = External::New(data);
+#endif
+
+  inst->SetNamedPropertyHandler(NamedGet,
+    handler->setter != NULL ? NamedSet : NULL,
+    handler->query != NULL ? NamedQuery : NULL,
+    NULL,
+    handler->enumerator != NULL ? NamedEnum : NULL,
+    ext);
+
+  return TRUE;
+}
+
+/**
+ * \param ctx Currently executing context
+ * \param klass The class
+ * \return The constructor, to be exported or passed to shim_obj_new()
+ */
+shim_val_s*
+shim_class_get_ctor(shim_ctx_s* ctx, shim_class_t* klass)
+{
+  return shim_val_new(ctx, class_template(ctx, klass)->GetFunction());
+}
+
+/**
+ * \param ctx Currently executing context
+ * \param klass The class
+ * \return The new instance, or NULL if it couldn't be created
+ *
+ * This is the fast path for handing out wrapped handles from C, the object
+ * is stamped from the instance template and the constructor isn't called.
+ */
+shim_val_s*
+shim_class_new_instance(shim_ctx_s* ctx, shim_class_t* klass)
+{
+  Local<FunctionTemplate> ft = class_template(ctx, klass);
+  Local<Object> obj = ft->InstanceTemplate()->NewInstance();
+
+  if (obj.IsEmpty())
+    return NULL;
+
+  private_field_init(obj);
+  return shim_val_new(ctx, obj);
+}
+
+/**
+ * \param ctx Currently executing context
+ * \param klass The class
+ * \param val The given value
+ * \return TRUE if the value was created from the class, otherwise FALSE
+ */
+shim_bool_t
+shim_class_is(shim_ctx_s* ctx, shim_class_t* klass, shim_val_s* val)
+{
+  Local<FunctionTemplate> ft = class_template(ctx, klass);
+  return ft->HasInstance(SHIM__TO_LOCAL(val->handle)) ? TRUE : FALSE;
+}
+
+/**
+ * \param stats Where to store the current counters
+ *
+ * From node 0.11.13 a module that creates functions dynamically should see
+ * live level off once the garbage collector catches up with the functions it
+ * dropped. Before that live always equals created.
+ */
+void
+shim_func_stats(shim_func_stats_t* stats)
+{
+  stats->live = fholder_live;
+  stats->created = fholder_created;
+}
+
+/**
+ * \param ctx Currently executing context
+ * \param self The this parameter of the function call
+ * \param sym The symbol representing the name of the function
+ * \param argc The number of args to pass the function
+ * \param argv The array of arguments to pass to the function
+ * \param rval The return value of the function
+ * \return TRUE if the function succeeded, otherwise FALSE
+ */
+shim_bool_t
+shim_func_call_sym(shim_ctx_s* ctx, shim_val_s* self, shim_val_s* sym,
+  size_t argc, shim_val_s** argv, shim_val_s** rval)
+{
+  assert(self != NULL);
+  Local<Object> recv = OBJ_TO_OBJECT(SHIM__TO_LOCAL(self->handle));
+
+  Local<String> str = OBJ_TO_STRING(SHIM__TO_LOCAL(sym->handle));
+  Handle<Value> ret = shim_call_func(ctx, recv, str, argc, argv);
+
+  if (rval != NULL)
+    *rval = shim_val_new(ctx, ret);
+
+  return !ctx->trycatch->HasCaught();
+}
+
+/**
+ * \param ctx Currently executing context
+ * \param self The this parameter of the function call
+ * \param name The name of the function
+ * \param argc The number of args to pass the function
+ * \param argv The array of arguments to pass to the function
+ * \param rval The return value of the function
+ * \return TRUE if the function succeeded, otherwise FALSE
+ */
+shim_bool_t
+shim_func_call_name(shim_ctx_s* ctx, shim_val_s* self, const char* name,
+  size_t argc, shim_val_s** argv, shim_val_s** rval)
+{
+  assert(self != NULL);
+  Local<Object> recv = OBJ_TO_OBJECT(SHIM__TO_LOCAL(self->handle));
+
+  Handle<Value> ret = shim_call_func(ctx, recv, NewSymbol(ctx, name), argc, argv);
+
+  if (rval != NULL)
+    *rval = shim_val_new(ctx, ret);
+
+  return !ctx->trycatch->HasCaught();
+}
+
+/**
+ * \param ctx Currently executing context
+ * \param self The this parameter of the function call
+ * \param key The key of the function
+ * \param argc The number of args to pass the function
+ * \param argv The array of arguments to pass to the function
+ * \param rval The return value of the function
+ * \return TRUE if the function succeeded, otherwise FALSE
+ */
+shim_bool_t
+shim_func_call_key(shim_ctx_s* ctx, shim_val_s* self, shim_key_s* key,
+  size_t argc, shim_val_s** argv, shim_val_s** rval)
+{
+  assert(self != NULL);
+  Local<Object> recv = OBJ_TO_OBJECT(SHIM__TO_LOCAL(self->handle));
+
+  Handle<Value> ret = shim_call_func(ctx, recv, key_local(key), argc, argv);
+
+  if (rval != NULL)
+    *rval = shim_val_new(ctx, ret);
+
+  return !ctx->trycatch->HasCaught();
+}
+
+/**
+ * \param ctx Currently executing context
+ * \param self The this parameter of the function call
+ * \param func The function to be called
+ * \param argc The number of args to pass the function
+ * \param argv The array of arguments to pass to the function
+ * \param rval The return value of the function
+ * \return TRUE if the function succeeded, otherwise FALSE
+ */
+shim_bool_t
+shim_func_call_val(shim_ctx_s* ctx, shim_val_s* self, shim_val_s* func,
+  size_t argc, shim_val_s** argv, shim_val_s** rval)
+{
+  SHIM__HANDLE_TYPE fh = func->handle;
+  assert(fh->IsFunction());
+  Local<Function> fn = SHIM__TO_LOCAL(fh).As<Function>();
+
+  Local<Object> recv;
+
+  if (self != NULL)
+    recv = OBJ_TO_OBJECT(SHIM__TO_LOCAL(self->handle));
+  else
+#if NODE_VERSION_AT_LEAST(0, 11, 11)
+    recv = Object::New(ctx->isolate);
+#else
+    recv = Object::New();
+#endif
+
+  Handle<Value> ret = shim_call_func(ctx, recv, fn, argc, argv);
+
+  if (rval != NULL)
+    *rval = shim_val_new(ctx, ret);
+
+  return !ctx->trycatch->HasCaught();
+}
+
+/**
+ * \param ctx Currently executing context
+ * \param self The this parameter of the function call
+ * \param sym The symbol representing the name of the function
+ * \param argc The number of args to pass the function
+ * \param argv The array of arguments to pass to the function
+ * \param rval The return value of the function
+ * \return TRUE if the function succeeded, otherwise FALSE
+ */
+shim_bool_t
+shim_make_callback_sym(shim_ctx_s* ctx, shim_val_s* self, shim_val_s* sym,
+  size_t argc, shim_val_s** argv, shim_val_s** rval)
+{
+  assert(self != NULL);
+
+  Local<Object> recv = OBJ_TO_OBJECT(SHIM__TO_LOCAL(self->handle));
+  Local<String> jsym = OBJ_TO_STRING(SHIM__TO_LOCAL(sym->handle));
+
+  SHIM__HANDLE_TYPE* jsargs = shim_vals_to_handles(ctx, argc, argv);
+
+#if NODE_VERSION_AT_LEAST(0, 11, 11)
+  Handle<Value> ret = node::MakeCallback(ctx->isolate, recv, jsym, argc, jsargs);
+#else
+  Handle<Value> ret = node::MakeCallback(recv, jsym, argc, jsargs);
+#endif
+
+  delete jsargs;
+
+  if (rval != NULL)
+    *rval = shim_val_new(ctx, ret);
+
+  return !ctx->trycatch->HasCaught();
+}
+
+/**
+ * \param ctx Currently executing context
+ * \param self The this parameter of the function call
+ * \param fval The function to call
+ * \param argc The number of args to pass the function
+ * \param argv The array of arguments to pass to the function
+ * \param rval The return value of the function
+ * \return TRUE if the function succeeded, otherwise FALSE
+ */
+shim_bool_t
+shim_make_callback_val(shim_ctx_s* ctx, shim_val_s* self, shim_val_s* fval,
+  size_t argc, shim_val_s** argv, shim_val_s** rval)
+{
+  /* TODO check is valid */
+  SHIM__HANDLE_TYPE prop = fval->handle;
+  Local<Function> fn = Local<Function>::Cast(SHIM__TO_LOCAL(prop));
+  SHIM__HANDLE_TYPE* jsargs = shim_vals_to_handles(ctx, argc, argv);
+
+  Local<Object> recv;
+
+  if (self != NULL) {
+    recv = OBJ_TO_OBJECT(SHIM__TO_LOCAL(self->handle));
+  } else {
+#if NODE_VERSION_AT_LEAST(0, 11, 11)
+    recv = Object::New(ctx->isolate);
+#else
+    recv = Object::New();
+#endif
+  }
+
+#if NODE_VERSION_AT_LEAST(0, 11, 11)
+  Handle<Value> ret = node::MakeCallback(ctx->isolate, recv, fn, argc, jsargs);
+#else
+  Handle<Value> ret = node::MakeCallback(recv, fn, argc, jsargs);
+#endif
+
+  delete jsargs;
+
+  if (rval != NULL)
+    *rval = shim_val_new(ctx, ret);
+
+  return !ctx->trycatch->HasCaught();
+}
 
 /**
- * \param val The value to check
- * \param type The expected type
- * \return TRUE or FALSE
- *
- * This doesn't coerce types, merely checks that the value is or isn't of the
- * desired type
+ * \param ctx Currently executing context
+ * \param obj The this parameter of the function call
+ * \param name The name of the function
+ * \param argc The number of args to pass the function
+ * \param argv The array of arguments to pass to the function
+ * \param rval The return value of the function
+ * \return TRUE if the function succeeded, otherwise FALSE
  */
 shim_bool_t
-shim_value_is(shim_val_s* val, shim_type_t type)
+shim_make_callback_name(shim_ctx_s* ctx, shim_val_s* obj, const char* name,
+  size_t argc, shim_val_s** argv, shim_val_s** rval)
 {
-  if (val->type == type)
-    return TRUE;
+  assert(obj != NULL);
 
-  SHIM__HANDLE_TYPE obj(val->handle);
+  SHIM__HANDLE_TYPE* jsargs = shim_vals_to_handles(ctx, argc, argv);
+  Local<Object> recv = OBJ_TO_OBJECT(SHIM__TO_LOCAL(obj->handle));
 
-  shim_bool_t ret = FALSE;
+#if NODE_VERSION_AT_LEAST(0, 11, 11)
+  Handle<Value> ret = node::MakeCallback(ctx->isolate, recv, name, argc, jsargs);
+#else
+  Handle<Value> ret = node::MakeCallback(recv, name, argc, jsargs);
+#endif
 
-  switch (type)
-  {
-    case SHIM_TYPE_OBJECT:
-      ret = obj->IsObject();
-      break;
-    case SHIM_TYPE_STRING:
-      ret = obj->IsString();
-      break;
-    case SHIM_TYPE_NUMBER:
-      ret = obj->IsNumber();
-      break;
-    case SHIM_TYPE_INTEGER:
-      /* TODO */
-      ret = obj->IsNumber();
-      break;
-    case SHIM_TYPE_INT32:
-      ret = obj->IsInt32();
-      break;
-    case SHIM_TYPE_UINT32:
-      ret = obj->IsUint32();
-      break;
-    case SHIM_TYPE_ARRAY:
-      ret = obj->IsArray();
-      break;
-    case SHIM_TYPE_BOOL:
-      ret = obj->IsBoolean();
-      break;
-    case SHIM_TYPE_UNDEFINED:
-      ret = obj->IsUndefined();
-      break;
-    case SHIM_TYPE_NULL:
-      ret = obj->IsNull();
-      break;
-    case SHIM_TYPE_EXTERNAL:
-      ret = obj->IsExternal();
-#if ! NODE_VERSION_AT_LEAST(0, 11, 3)
-      if (ret == FALSE && obj->IsObject()) {
-        Handle<Object> o = obj.As<Object>();
+  delete jsargs;
 
-        Local<Value> v = o->GetHiddenValue(hidden_private);
-        ret = v->IsExternal();
-      }
+  if (rval != NULL)
+    *rval = shim_val_new(ctx, ret);
+
+  return !ctx->trycatch->HasCaught();
+}
+
+/**
+ * \param ctx Current executing context
+ * \param d The value of the new number
+ * \return The wrapped number
+ */
+shim_val_s*
+shim_number_new(shim_ctx_s* ctx, double d)
+{
+#if NODE_VERSION_AT_LEAST(0, 11, 11)
+  return shim_val_new(ctx, Number::New(ctx->isolate, d));
+#else
+  return shim_val_new(ctx, Number::New(d));
 #endif
-      break;
-    case SHIM_TYPE_DATE:
-      ret = obj->IsDate();
-      break;
-    case SHIM_TYPE_FUNCTION:
-      ret = obj->IsFunction();
-      break;
-    case SHIM_TYPE_BUFFER:
-      ret = node::Buffer::HasInstance(obj);
-      break;
-    case SHIM_TYPE_UNKNOWN:
-    default:
-      ret = FALSE;
-      break;
-  }
+}
 
-  if (ret)
-    val->type = type;
+/**
+ * \param val The given number
+ * \return The value of the number
+ */
+double
+shim_number_value(shim_val_s* val)
+{
+  return val->handle->NumberValue();
+}
+
+/**
+ * \param ctx Current executing context
+ * \param i The value of the new integer
+ * \return The wrapped integer
+ */
+shim_val_s*
+shim_integer_new(shim_ctx_s* ctx, int32_t i)
+{
+#if NODE_VERSION_AT_LEAST(0, 11, 11)
+  return shim_val_new(ctx, Integer::New(ctx->isolate, i));
+#else
+  return shim_val_new(ctx, Integer::New(i));
+#endif
+}
+
+/**
+ * \param ctx Current executing context
+ * \param i The value of the new integer
+ * \return The wrapped integer
+ */
+shim_val_s*
+shim_integer_uint(shim_ctx_s* ctx, uint32_t i)
+{
+#if NODE_VERSION_AT_LEAST(0, 11, 11)
+  return shim_val_new(ctx, Integer::NewFromUnsigned(ctx->isolate, i));
+#else
+  return shim_val_new(ctx, Integer::NewFromUnsigned(i));
+#endif
+}
+
+/**
+ * \param val The given integer
+ * \return The value of the integer
+ */
+int64_t
+shim_integer_value(shim_val_s* val)
+{
+  return val->handle->IntegerValue();
+}
+
+/**
+ * \param val The given integer
+ * \return The int32_t value of the integer
+ */
+int32_t
+shim_integer_int32_value(shim_val_s* val)
+{
+  return val->handle->Int32Value();
+}
+
+/**
+ * \param val The given integer
+ * \return The uint32_t value of the integer
+ */
+uint32_t
+shim_integer_uint32_value(shim_val_s* val)
+{
+  return val->handle->Uint32Value();
+}
+
+/**
+ * \param ctx Current executing context
+ * \return Wrapped empty string
+ */
+shim_val_s*
+shim_string_new(shim_ctx_s* ctx)
+{
+#if NODE_VERSION_AT_LEAST(0, 11, 11)
+  return shim_val_new(ctx, String::Empty(ctx->isolate));
+#else
+  return shim_val_new(ctx, String::Empty());
+#endif
+}
+
+/**
+ * \param ctx Current executing context
+ * \param data Source null terminated string
+ * \return The wrapped string
+ */
+shim_val_s*
+shim_string_new_copy(shim_ctx_s* ctx, const char* data)
+{
+#if NODE_VERSION_AT_LEAST(0, 11, 11)
+  return shim_val_new(ctx, String::NewFromUtf8(ctx->isolate, data));
+#else
+  return shim_val_new(ctx, String::New(data));
+#endif
+}
+
+/**
+ * \param ctx Current executing context
+ * \param data Source string
+ * \param len Length of created string
+ * \return The wrapped string
+ */
+shim_val_s*
+shim_string_new_copyn(shim_ctx_s* ctx, const char* data, size_t len)
+{
+#if NODE_VERSION_AT_LEAST(0, 11, 11)
+  return shim_val_new(ctx, String::NewFromUtf8(ctx->isolate,
+                                               data,
+                                               String::kNormalString,
+                                               len));
+#else
+  return shim_val_new(ctx, String::New(data, len));
+#endif
+}
+
+/**
+ * \param val The given string
+ * \return The length of the string
+ */
+size_t
+shim_string_length(shim_val_s* val)
+{
+  return OBJ_TO_STRING(val->handle)->Length();
+}
 
-  return ret;
+/**
+ * \param val The given string
+ * \return The length of the UTF-8 encoded string
+ */
+size_t
+shim_string_length_utf8(shim_val_s* val)
+{
+  return OBJ_TO_STRING(val->handle)->Utf8Length();
 }
 
 /**
- * \param ctx The currently executed context
- * \param val The given value
- * \param type The desired type
- * \param rval The destination value
- * \return TRUE or FALSE
+ * \param val The given string
+ * \return The C string value of the string
  *
- * Attempts to coerce the given value into another type, if it fails to do so
- * returns FALSE.
+ * The caller is responsible for free'ing this memory
  */
-shim_bool_t
-shim_value_to(shim_ctx_s* ctx, shim_val_s* val, shim_type_t type,
-  shim_val_s** srval)
+char*
+shim_string_value(shim_val_s* val)
 {
-  shim_val_s* rval = shim_value_alloc();
-  *srval = rval;
-
-  if (val->type == type) {
-    rval->type = type;
-    rval->handle = val->handle;
-    return TRUE;
-  }
-
-
-  Local<Value> obj = SHIM__TO_LOCAL(val->handle);
+  String::Utf8Value str(OBJ_TO_STRING(val->handle));
+  return strdup(*str);
+}
 
-  switch (type) {
-    case SHIM_TYPE_UNDEFINED:
-#if NODE_VERSION_AT_LEAST(0, 11, 11)
-      rval->handle = Undefined(ctx->isolate);
+/**
+ * \param val The given string
+ * \param buff The destination buffer
+ * \param start The starting position to encode
+ * \param len The length of the string to create
+ * \param options The options for how to encode the string
+ */
+size_t
+shim_string_write_ascii(shim_val_s* val, char* buff, size_t start, size_t len,
+  int32_t options)
+{
+  String str = **OBJ_TO_STRING(val->handle);
+#if NODE_VERSION_AT_LEAST(0, 11, 9)
+  return str.WriteOneByte(reinterpret_cast<uint8_t*>(buff), start, len);
 #else
-      rval->handle = Undefined();
+  return str.WriteAscii(buff, start, len);
 #endif
-      break;
-    case SHIM_TYPE_NULL:
+}
+
+/**
+ * \param ctx Current executing context
+ * \param len Length of array to be created
+ * \return Wrapped array
+ */
+shim_val_s*
+shim_array_new(shim_ctx_s* ctx, size_t len)
+{
 #if NODE_VERSION_AT_LEAST(0, 11, 11)
-      rval->handle = Null(ctx->isolate);
-#else
-      rval->handle = Null();
-#endif
-      break;
-    case SHIM_TYPE_BOOL:
-      rval->handle = obj->ToBoolean();
-      break;
-    case SHIM_TYPE_ARRAY:
-      rval->handle = OBJ_TO_ARRAY(obj);
-      break;
-    case SHIM_TYPE_OBJECT:
-      rval->handle = OBJ_TO_OBJECT(obj);
-      break;
-    case SHIM_TYPE_INTEGER:
-      /* TODO */
-      rval->handle = OBJ_TO_NUMBER(obj);
-      break;
-    case SHIM_TYPE_INT32:
-      rval->handle = OBJ_TO_INT32(obj);
-      break;
-    case SHIM_TYPE_UINT32:
-      rval->handle = OBJ_TO_UINT32(obj);
-      break;
-    case SHIM_TYPE_NUMBER:
-      rval->handle = OBJ_TO_NUMBER(obj);
-      break;
-    case SHIM_TYPE_EXTERNAL:
-#if NODE_VERSION_AT_LEAST(0, 11, 3)
-      rval->handle = OBJ_TO_EXTERNAL(obj);
+  return shim_val_new(ctx, Array::New(ctx->isolate, len));
 #else
-      if (obj->IsExternal())
-        rval->handle = obj.As<External>();
-      else
-        rval->handle = OBJ_TO_EXTERNAL(obj->ToObject()->GetHiddenValue(hidden_private));
+  return shim_val_new(ctx, Array::New(len));
 #endif
-      break;
-    case SHIM_TYPE_FUNCTION:
-      rval->handle = OBJ_TO_FUNCTION(obj);
-      break;
-    case SHIM_TYPE_STRING:
-      rval->handle = OBJ_TO_STRING(obj);
-    case SHIM_TYPE_UNKNOWN:
-    default:
-      return FALSE;
-  }
+}
 
-  rval->type = type;
+/**
+ * \param arr Given array
+ * \return Length of the array
+ */
+size_t
+shim_array_length(shim_val_s* arr)
+{
+  return OBJ_TO_ARRAY(SHIM__TO_LOCAL(arr->handle))->Length();
+}
+
+/**
+ * \param ctx Current executing context
+ * \param arr Given array
+ * \param idx Index of element
+ * \param rval Actual return value
+ * \return TRUE if the value existed, otherwise FALSE
+ */
+shim_bool_t
+shim_array_get(shim_ctx_s* ctx, shim_val_s* arr, int32_t idx, shim_val_s** rval)
+{
+  *rval = shim_val_new(ctx, OBJ_TO_ARRAY(SHIM__TO_LOCAL(arr->handle))->Get(idx));
   return TRUE;
 }
 
+/**
+ * \param ctx Current executing context
+ * \param arr Given array
+ * \param idx Index of element
+ * \param val Value to be set
+ * \return TRUE if the value was able to be set, otherwise FALSE
+ */
+shim_bool_t
+shim_array_set(shim_ctx_s* ctx, shim_val_s* arr, int32_t idx, shim_val_s* val)
+{
+  return OBJ_TO_ARRAY(SHIM__TO_LOCAL(arr->handle))->Set(idx, val->handle);
+}
+
+
+/**
+ * \param ctx Current executing context
+ * \param arr A numeric Array or typed array
+ * \param out The buffer to fill
+ * \param len The number of elements out has room for
+ * \param written Where to store how many elements were converted, may be NULL
+ * \return TRUE if every element was a number, otherwise FALSE and an
+ * exception is set
+ *
+ * Converts up to len elements in a single native loop without wrapping any
+ * of them. A Float64Array is copied with memcpy and other typed arrays are
+ * widened straight from their memory. Anything that is neither an Array nor
+ * a typed array throws a TypeError.
+ */
+shim_bool_t
+shim_array_to_doubles(shim_ctx_s* ctx, shim_val_s* arr, double* out,
+  size_t len, size_t* written)
+{
+  return array_to_numbers(ctx, arr, out, len, written, SHIM_TYPED_FLOAT64);
+}
+
+/**
+ * \param ctx Current executing context
+ * \param arr A numeric Array or typed array
+ * \param out The buffer to fill
+ * \param len The number of elements out has room for
+ * \param written Where to store how many elements were converted, may be NULL
+ * \return TRUE if every element was a number, otherwise FALSE and an
+ * exception is set
+ *
+ * Like shim_array_to_doubles(), numbers are truncated as by ToInt32 and an
+ * Int32Array is copied with memcpy.
+ */
+shim_bool_t
+shim_array_to_int32s(shim_ctx_s* ctx, shim_val_s* arr, int32_t* out,
+  size_t len, size_t* written)
+{
+  return array_to_numbers(ctx, arr, out, len, written, SHIM_TYPED_INT32);
+}
 
+/**
+ * \param ctx Current executing context
+ * \param data The numbers to copy
+ * \param len The number of elements
+ * \return Wrapped array
+ */
 shim_val_s*
-shim_undefined()
+shim_array_from_doubles(shim_ctx_s* ctx, const double* data, size_t len)
 {
-  return &shim__undefined;
+  return array_from_numbers(ctx, data, len);
 }
 
+/**
+ * \param ctx Current executing context
+ * \param data The numbers to copy
+ * \param len The number of elements
+ * \return Wrapped array
+ */
+shim_val_s*
+shim_array_from_int32s(shim_ctx_s* ctx, const int32_t* data, size_t len)
+{
+  return array_from_numbers(ctx, data, len);
+}
 
+/**
+ * \param ctx Current executing context
+ * \param len Size of buffer to create
+ * \return Wrapped buffer
+ */
 shim_val_s*
-shim_null()
+shim_buffer_new(shim_ctx_s* ctx, size_t len)
 {
-  return &shim__null;
+#if NODE_VERSION_AT_LEAST(0, 11, 3)
+  return shim_val_new(ctx, node::Buffer::New(len));
+#else
+  return shim_val_new(ctx, SHIM__TO_LOCAL(Buffer::New(len)->handle_));
+#endif
 }
 
 /**
- * \sa [memory](md_docs_memory.html)
- *
- * Allocate memory to hold an arbitrary handle.
+ * \param ctx Current executing context
+ * \param data Data to be copied
+ * \param len Length of data to be copied
+ * \return Wrapped buffer
  */
 shim_val_s*
-shim_value_alloc(void)
+shim_buffer_new_copy(shim_ctx_s* ctx, const char* data, size_t len)
 {
-  shim_val_s *val = new shim_val_s();
-  return (val);
+#if NODE_VERSION_AT_LEAST(0, 11, 3)
+  return shim_val_new(ctx, node::Buffer::New(data, len));
+#elif NODE_VERSION_AT_LEAST(0, 10, 0)
+  return shim_val_new(ctx, SHIM__TO_LOCAL(Buffer::New(data, len)->handle_));
+#else
+  return shim_val_new(ctx, SHIM__TO_LOCAL(Buffer::New((char*)data, len)->handle_));
+#endif
 }
 
 /**
- * \param val The given value
- * \sa [memory](md_docs_memory.html)
+ * \param ctx Current executing context
+ * \param data Data to be used for underlying memory
+ * \param len Size of memory being used
+ * \param cb Callback that is called when buffer is to be freed
+ * \param hint Arbitrary data passed to the callback
+ * \return Wrapped buffer
  *
- * Presuming the value was not allocated for ::shim_args_s or being used for
- * shim_args_set_rval() use this method to free the allocated memory
+ * The underlying memory is not copied, but used in place
  */
-void
-shim_value_release(shim_val_s* val)
+shim_val_s*
+shim_buffer_new_external(shim_ctx_s* ctx, char* data, size_t len,
+  shim_buffer_free cb, void* hint)
 {
-  if (val != NULL && val->type != SHIM_TYPE_NULL
-      && val->type != SHIM_TYPE_UNDEFINED)
-    delete val;
+#if NODE_VERSION_AT_LEAST(0, 11, 3)
+  return shim_val_new(ctx, node::Buffer::New(data, len, cb, hint));
+#else
+  Buffer* buf = Buffer::New(data, len, cb, hint);
+  shim_val_s* tmp = shim_val_new(ctx, Local<Object>::New(buf->handle_));
+  return tmp;
+#endif
+}
+
+/**
+ * \param val THe given buffer
+ * \return Pointer to the underlying memory
+ */
+char*
+shim_buffer_value(shim_val_s* val)
+{
+  Local<Value> v = SHIM__TO_LOCAL(val->handle);
+
+#if NODE_VERSION_AT_LEAST(0, 11, 3)
+  assert(node::Buffer::HasInstance(v));
+  return node::Buffer::Data(v);
+#elif NODE_VERSION_AT_LEAST(0, 10, 0)
+  assert(Buffer::HasInstance(v));
+  return Buffer::Data(v);
+#else
+  assert(Buffer::HasInstance(v));
+  return Buffer::Data(v.As<Object>());
+#endif
+}
+
+/* typed arrays keep their elements in an external array either way */
+#if NODE_VERSION_AT_LEAST(0, 11, 5)
+shim_typed_t
+typed_kind(Local<Value> val)
+{
+  if (val->IsInt8Array())
+    return SHIM_TYPED_INT8;
+  if (val->IsUint8Array())
+    return SHIM_TYPED_UINT8;
+  if (val->IsUint8ClampedArray())
+    return SHIM_TYPED_UINT8_CLAMPED;
+  if (val->IsInt16Array())
+    return SHIM_TYPED_INT16;
+  if (val->IsUint16Array())
+    return SHIM_TYPED_UINT16;
+  if (val->IsInt32Array())
+    return SHIM_TYPED_INT32;
+  if (val->IsUint32Array())
+    return SHIM_TYPED_UINT32;
+  if (val->IsFloat32Array())
+    return SHIM_TYPED_FLOAT32;
+  if (val->IsFloat64Array())
+    return SHIM_TYPED_FLOAT64;
+  return SHIM_TYPED_UNKNOWN;
+}
+#else
+shim_typed_t
+typed_kind(v8::ExternalArrayType type)
+{
+  switch (type) {
+    case v8::kExternalByteArray:          return SHIM_TYPED_INT8;
+    case v8::kExternalUnsignedByteArray:  return SHIM_TYPED_UINT8;
+    case v8::kExternalPixelArray:         return SHIM_TYPED_UINT8_CLAMPED;
+    case v8::kExternalShortArray:         return SHIM_TYPED_INT16;
+    case v8::kExternalUnsignedShortArray: return SHIM_TYPED_UINT16;
+    case v8::kExternalIntArray:           return SHIM_TYPED_INT32;
+    case v8::kExternalUnsignedIntArray:   return SHIM_TYPED_UINT32;
+    case v8::kExternalFloatArray:         return SHIM_TYPED_FLOAT32;
+    case v8::kExternalDoubleArray:        return SHIM_TYPED_FLOAT64;
+    default:                              return SHIM_TYPED_UNKNOWN;
+  }
 }
 
 
-/**
- * \param ctx The currently executing context
- * \param klass The constructor to be used (may be NULL)
- * \param proto The prototype that should be used (may be NULL)
- * \return A pointer to the created object
- * \sa shim_value_release()
- */
-shim_val_s*
-shim_obj_new(shim_ctx_s* ctx, shim_val_s* klass, shim_val_s* proto)
+v8::ExternalArrayType
+typed_external(shim_typed_t type)
 {
-  /* TODO if klass != NULL we should FunctionTemplate::New() */
-#if NODE_VERSION_AT_LEAST(0, 11, 9)
-  Local<Object> obj = Object::New(ctx->isolate);
-#else
-  Local<Object> obj = Object::New();
+  switch (type) {
+    case SHIM_TYPED_INT8:          return v8::kExternalByteArray;
+    case SHIM_TYPED_UINT8_CLAMPED: return v8::kExternalPixelArray;
+    case SHIM_TYPED_INT16:         return v8::kExternalShortArray;
+    case SHIM_TYPED_UINT16:        return v8::kExternalUnsignedShortArray;
+    case SHIM_TYPED_INT32:         return v8::kExternalIntArray;
+    case SHIM_TYPED_UINT32:        return v8::kExternalUnsignedIntArray;
+    case SHIM_TYPED_FLOAT32:       return v8::kExternalFloatArray;
+    case SHIM_TYPED_FLOAT64:       return v8::kExternalDoubleArray;
+    case SHIM_TYPED_UINT8:
+    default:                       return v8::kExternalUnsignedByteArray;
+  }
+}
 #endif
 
-  if (proto != NULL)
-    obj->SetPrototype(proto->handle->ToObject());
 
-  return new shim_val_s(obj);
+size_t
+typed_size(shim_typed_t type)
+{
+  switch (type) {
+    case SHIM_TYPED_INT16:
+    case SHIM_TYPED_UINT16:
+      return 2;
+    case SHIM_TYPED_INT32:
+    case SHIM_TYPED_UINT32:
+    case SHIM_TYPED_FLOAT32:
+      return 4;
+    case SHIM_TYPED_FLOAT64:
+      return 8;
+    default:
+      return 1;
+  }
 }
 
-
 /**
- * \param ctx The currently executing context
- * \param klass The given constructor
- * \param argc The amount of arguments being passed
- * \param argv The array of arguments to be passed
- * \return The returned object
- *
- * Use this to instantiate an object with the given arguments
+ * \param val The given buffer
+ * \return THe size of the buffer
  */
-shim_val_s*
-shim_obj_new_instance(shim_ctx_s* ctx, shim_val_s* klass, size_t argc,
-  shim_val_s** argv)
+size_t
+shim_buffer_length(shim_val_s* val)
 {
-  return NULL;
+  Local<Value> v = SHIM__TO_LOCAL(val->handle);
+
+#if NODE_VERSION_AT_LEAST(0, 11, 3)
+  assert(node::Buffer::HasInstance(v));
+  return node::Buffer::Length(v);
+#elif NODE_VERSION_AT_LEAST(0, 10, 0)
+  assert(Buffer::HasInstance(v));
+  return Buffer::Length(v);
+#else
+  assert(Buffer::HasInstance(v));
+  return Buffer::Length(v.As<Object>());
+#endif
 }
 
 /**
- * \param ctx The currently executing context
- * \param src The given value
- * \return The new Local value representing the previous value
+ * \param val The given ArrayBuffer
+ * \param len Where to store the length in bytes, may be NULL
+ * \return Pointer to the underlying memory
  *
- * Use this when you might want to create a Local of a persistent
- * \sa persistents
+ * The memory is used in place and stays owned by the ArrayBuffer
  */
-shim_val_s*
-shim_obj_clone(shim_ctx_s* ctx, shim_val_s* src)
+void*
+shim_array_buffer_value(shim_val_s* val, size_t* len)
 {
+  Local<Value> v = SHIM__TO_LOCAL(val->handle);
+
+#if NODE_VERSION_AT_LEAST(0, 11, 5)
+  assert(v->IsArrayBuffer());
+  Local<v8::ArrayBuffer> ab = v.As<v8::ArrayBuffer>();
+  size_t bytes = ab->ByteLength();
+
+  /*
+   * The store is only reachable through a view, externalizing would take it
+   * from V8. Make the view once and keep it on the buffer.
+   */
 #if NODE_VERSION_AT_LEAST(0, 11, 9)
-  Local<Value> dst = Local<Value>::New(ctx->isolate, src->handle);
+  Local<String> hv = PersistentToLocal<String>(Isolate::GetCurrent(),
+    hidden_view);
 #else
-  Local<Value> dst = Local<Value>::New(src->handle);
+  Local<String> hv = Local<String>::New(Isolate::GetCurrent(), hidden_view);
 #endif
-  return new shim_val_s(dst);
-}
+  Local<Value> cached = ab->GetHiddenValue(hv);
+  Local<Object> view;
 
-/**
- * \param ctx The currently executing context
- * \param val The given object
- * \param name The name of the property
- * \return TRUE if the object has the named property, otherwise FALSE
- *
- * Has the name
- */
-shim_bool_t
-shim_obj_has_name(shim_ctx_s* ctx, shim_val_s* val, const char* name)
-{
-  Local<Object> obj = OBJ_TO_OBJECT(SHIM__TO_LOCAL(val->handle));
-  return obj->Has(NewSymbol(ctx, name)) ? TRUE : FALSE;
-}
+  if (!cached.IsEmpty() && cached->IsObject()) {
+    view = cached.As<Object>();
+  } else {
+    view = v8::Uint8Array::New(ab, 0, bytes);
+    ab->SetHiddenValue(hv, view);
+  }
 
-/**
- * \param ctx The currently executing context
- * \param val The given object
- * \param id The id of the property
- * \return TRUE if the object has the indexed property, otherwise FALSE
- *
- * Object can have ordered properties, or may be an array, use this to check
- * if either exist.
- */
-shim_bool_t
-shim_obj_has_id(shim_ctx_s* ctx, shim_val_s* val, uint32_t id)
-{
-  Local<Object> obj = OBJ_TO_OBJECT(SHIM__TO_LOCAL(val->handle));
-  return obj->Has(id) ? TRUE : FALSE;
-}
+  if (len != NULL)
+    *len = bytes;
 
-/**
- * \param ctx The currently executing context
- * \param val The given object
- * \param sym The symbol of the property
- * \return TRUE if the object has the property, otherwise FALSE
- *
- * Use this if you are keeping a reference to a commonly used symbol name
- * or are passed a value to lookup
- */
-shim_bool_t
-shim_obj_has_sym(shim_ctx_s* ctx, shim_val_s* val, shim_val_s* sym)
-{
-  Local<Object> obj = OBJ_TO_OBJECT(SHIM__TO_LOCAL(val->handle));
-  return obj->Has(OBJ_TO_STRING(sym->handle));
+  return view->GetIndexedPropertiesExternalArrayData();
+#else
+  Local<Object> obj = v.As<Object>();
+  assert(obj->HasIndexedPropertiesInExternalArrayData());
+
+  if (len != NULL)
+    *len = obj->GetIndexedPropertiesExternalArrayDataLength();
+
+  return obj->GetIndexedPropertiesExternalArrayData();
+#endif
 }
 
 /**
- * \param ctx The currently executing context
- * \param obj The given object
- * \param name The name of the property
- * \param val The value to be stored
- * \return TRUE if the property was set, otherwise FALSE
+ * \param val The given typed array
+ * \param len Where to store the number of elements, may be NULL
+ * \param type Where to store the element type, may be NULL
+ * \return Pointer to the first element of the view
+ *
+ * The memory is used in place, the view's byte offset is already applied
  */
-shim_bool_t
-shim_obj_set_prop_name(shim_ctx_s* ctx, shim_val_s* obj, const char* name,
-  shim_val_s* val)
+void*
+shim_typed_array_value(shim_val_s* val, size_t* len, shim_typed_t* type)
 {
-  Local<Object> jsobj = OBJ_TO_OBJECT(SHIM__TO_LOCAL(obj->handle));
-  return jsobj->Set(NewSymbol(ctx, name), val->handle);
-}
+  Local<Value> v = SHIM__TO_LOCAL(val->handle);
+  Local<Object> obj = v.As<Object>();
 
+#if NODE_VERSION_AT_LEAST(0, 11, 5)
+  assert(v->IsTypedArray());
 
-/**
- * \param ctx The currently executing context
- * \param obj The given object
- * \param id The id of the property
- * \param val The value to be stored
- * \return TRUE if the property was set, otherwise FALSE
- */
-shim_bool_t
-shim_obj_set_prop_id(shim_ctx_s* ctx, shim_val_s* obj, uint32_t id,
-  shim_val_s* val)
-{
-  Local<Object> jsobj = OBJ_TO_OBJECT(SHIM__TO_LOCAL(obj->handle));
-  return jsobj->Set(id, val->handle);
-}
+  if (len != NULL)
+    *len = v.As<v8::TypedArray>()->Length();
+  if (type != NULL)
+    *type = typed_kind(v);
+#else
+  assert(obj->HasIndexedPropertiesInExternalArrayData());
 
+  if (len != NULL)
+    *len = obj->GetIndexedPropertiesExternalArrayDataLength();
+  if (type != NULL)
+    *type = typed_kind(obj->GetIndexedPropertiesExternalArrayDataType());
+#endif
 
-/**
- * \param ctx The currently executing context
- * \param obj The given object
- * \param sym The symbol of the property
- * \param val The value to be stored
- * \return TRUE if the property was set, otherwise FALSE
- */
-shim_bool_t
-shim_obj_set_prop_sym(shim_ctx_s* ctx, shim_val_s* obj, shim_val_s* sym,
-  shim_val_s* val)
-{
-  Local<Object> jsobj = OBJ_TO_OBJECT(SHIM__TO_LOCAL(obj->handle));
-  return jsobj->Set(sym->handle, val->handle);
+  return obj->GetIndexedPropertiesExternalArrayData();
 }
 
 /**
- * \param ctx The currently executing context
- * \param obj The given object
- * \param data The data to be associated with the object
- * \return TRUE if the data was able to be associated, otherwise FALSE
+ * \param ctx Currently executing context
+ * \param data The memory to expose
+ * \param len The length in bytes
+ * \return The ArrayBuffer, or NULL if unsupported on this version of node
  *
- * Use this to associate C memory with a given object, which can be recalled
- * at a later time with shim_obj_get_private()
+ * The memory is not copied and is never freed by V8, it has to outlive the
+ * ArrayBuffer. Make the object weak to find out when that is.
  *
  * \sa shim_obj_make_weak()
  */
-shim_bool_t
-shim_obj_set_private(shim_ctx_s* ctx, shim_val_s* obj, void* data)
+shim_val_s*
+shim_array_buffer_new_external(shim_ctx_s* ctx, void* data, size_t len)
 {
-  Local<Object> jsobj = OBJ_TO_OBJECT(SHIM__TO_LOCAL(obj->handle));
-#if NODE_VERSION_AT_LEAST(0, 11, 9)
-  Local<String> hp = PersistentToLocal<String>(ctx->isolate, hidden_private);
-  return jsobj->SetHiddenValue(hp, External::New(ctx->isolate, data));
+#if NODE_VERSION_AT_LEAST(0, 11, 11)
+  return shim_val_new(ctx, v8::ArrayBuffer::New(ctx->isolate, data, len));
+#elif NODE_VERSION_AT_LEAST(0, 11, 5)
+  return shim_val_new(ctx, v8::ArrayBuffer::New(data, len));
 #else
-  return jsobj->SetHiddenValue(hidden_private, External::New(data));
+  return NULL;
 #endif
 }
 
 /**
- * \param ctx The currently executing context
- * \param recv The object to add the functions to
- * \param funcs The null terminated array of functions
- * \return TRUE if all functions were able to be added, otherwise FALSE
+ * \param ctx Currently executing context
+ * \param data The elements to expose
+ * \param len The number of elements
+ * \param type The element type
+ * \return The typed array
+ *
+ * The memory is not copied and is never freed by V8, it has to outlive the
+ * typed array. Before node 0.11.5 the result is a plain object indexed
+ * straight into the memory, with a length property.
  */
-shim_bool_t
-shim_obj_set_funcs(shim_ctx_s* ctx, shim_val_s* recv,
-  const shim_fspec_t* funcs)
+shim_val_s*
+shim_typed_array_new_external(shim_ctx_s* ctx, void* data, size_t len,
+  shim_typed_t type)
 {
-  size_t i = 0;
-  shim_fspec_s cur = funcs[i];
-  while (cur.name != NULL) {
-    shim_val_s* func = shim_func_new(ctx, cur.cfunc, cur.nargs, cur.flags,
-      cur.name, cur.data);
-
-    if (!shim::shim_obj_set_prop_name(ctx, recv, cur.name, func))
-      return FALSE;
+#if NODE_VERSION_AT_LEAST(0, 11, 5)
+  Local<v8::ArrayBuffer> ab = SHIM__TO_LOCAL(
+    shim_array_buffer_new_external(ctx, data, len * typed_size(type))->handle)
+    .As<v8::ArrayBuffer>();
+  Local<Object> view;
 
-    shim::shim_value_release(func);
-    cur = funcs[++i];
+  switch (type) {
+    case SHIM_TYPED_INT8:
+      view = v8::Int8Array::New(ab, 0, len);
+      break;
+    case SHIM_TYPED_UINT8_CLAMPED:
+      view = v8::Uint8ClampedArray::New(ab, 0, len);
+      break;
+    case SHIM_TYPED_INT16:
+      view = v8::Int16Array::New(ab, 0, len);
+      break;
+    case SHIM_TYPED_UINT16:
+      view = v8::Uint16Array::New(ab, 0, len);
+      break;
+    case SHIM_TYPED_INT32:
+      view = v8::Int32Array::New(ab, 0, len);
+      break;
+    case SHIM_TYPED_UINT32:
+      view = v8::Uint32Array::New(ab, 0, len);
+      break;
+    case SHIM_TYPED_FLOAT32:
+      view = v8::Float32Array::New(ab, 0, len);
+      break;
+    case SHIM_TYPED_FLOAT64:
+      view = v8::Float64Array::New(ab, 0, len);
+      break;
+    case SHIM_TYPED_UINT8:
+    default:
+      view = v8::Uint8Array::New(ab, 0, len);
+      break;
   }
 
-  return TRUE;
+  return shim_val_new(ctx, view);
+#else
+  Local<Object> obj = Object::New();
+  obj->SetIndexedPropertiesToExternalArrayData(data, typed_external(type),
+    len);
+  obj->Set(NewSymbol(ctx, "length"), Integer::NewFromUnsigned(len));
+  return shim_val_new(ctx, obj);
+#endif
 }
 
 /**
- * \param ctx The currently executing context
- * \param obj The the given object
- * \param name The name of the property
- * \param rval The actual value returned
- * \return TRUE if object had the propert, otherwise FALSE
+ * \param ctx Currently executing context
+ * \param data The external data to wrap
+ * \return Wrapped external
+ *
+ * This is an object that is safe to pass to and from JavaScript.
+ * \sa persistents
  */
-shim_bool_t
-shim_obj_get_prop_name(shim_ctx_s* ctx, shim_val_s* obj, const char* name,
-  shim_val_s** rval)
+shim_val_s*
+shim_external_new(shim_ctx_s* ctx, void* data)
 {
-  Local<Object> jsobj = OBJ_TO_OBJECT(SHIM__TO_LOCAL(obj->handle));
-  Local<Value> val = jsobj->Get(NewSymbol(ctx, name));
-  *rval = new shim_val_s(val);
-  return TRUE;
-}
-
+#if NODE_VERSION_AT_LEAST(0, 11, 11)
+  Local<External> ext = External::New(ctx->isolate, data);
+#else
+  Local<External> ext = External::New(data);
+#endif
+  shim_val_s* ret;
 
-/**
- * \param ctx The currently executing context
- * \param obj The the given object
- * \param idx The id of the property
- * \param rval The actual value returned
- * \return TRUE if object had the propert, otherwise FALSE
- */
-shim_bool_t
-shim_obj_get_prop_id(shim_ctx_s* ctx, shim_val_s* obj, uint32_t idx,
-  shim_val_s** rval)
-{
-  Local<Object> jsobj = OBJ_TO_OBJECT(SHIM__TO_LOCAL(obj->handle));
-  Local<Value> val = jsobj->Get(idx);
-  *rval = new shim_val_s(val);
-  return TRUE;
-}
+#if NODE_VERSION_AT_LEAST(0, 11, 3)
+  ret = shim_val_new(ctx, ext);
+#else
+  Local<Object> o = Object::New();
+  o->SetHiddenValue(hidden_private, ext);
+  ret = shim_val_new(ctx, o, SHIM_TYPE_EXTERNAL);
+#endif
 
+  return ret;
+}
 
 /**
- * \param ctx The currently executing context
- * \param obj The the given object
- * \param sym The symbol of the property
- * \param rval The actual value returned
- * \return TRUE if object had the propert, otherwise FALSE
+ * \param ctx Currently executing context
+ * \param obj The given external
+ * \return The pointer to the wrapped memory
  */
-shim_bool_t
-shim_obj_get_prop_sym(shim_ctx_s* ctx, shim_val_s* obj, shim_val_s* sym,
-  shim_val_s** rval)
+void*
+shim_external_value(shim_ctx_s* ctx, shim_val_s* obj)
 {
-  Local<Object> jsobj = OBJ_TO_OBJECT(SHIM__TO_LOCAL(obj->handle));
-  Local<Value> val = jsobj->Get(sym->handle);
-  *rval = new shim_val_s(val);
-  return TRUE;
-}
+  Local<Value> v(SHIM__TO_LOCAL(obj->handle));
+
+#if ! NODE_VERSION_AT_LEAST(0, 11, 3)
+  if (v->IsObject()) {
+    Handle<Object> o = v.As<Object>();
+
+    if (!o->IsUndefined() && !o.IsEmpty())
+      v = o->GetHiddenValue(hidden_private);
+  }
+#endif
 
+  if (v->IsUndefined() || !v->IsExternal())
+    return NULL;
+  else
+    return v.As<External>()->Value();
+}
 
 /**
- * \param ctx The currently executing context
- * \param obj The the given object
- * \param data The actual data
- * \return TRUE if the object had hidden data, otherwise FALSE
+ * \param ctx Currently executing context
+ * \param msg The message to be used for error
+ * \param ... Arguments for formatting
+ * \return The wrapped Error
  */
-shim_bool_t
-shim_obj_get_private(shim_ctx_s* ctx, shim_val_s* obj, void** data)
+shim_val_s*
+shim_error_new(shim_ctx_s* ctx, const char* msg, ...)
 {
-  Local<Object> jsobj = OBJ_TO_OBJECT(SHIM__TO_LOCAL(obj->handle));
-#if NODE_VERSION_AT_LEAST(0, 11, 9)
-  Local<String> hp = PersistentToLocal<String>(ctx->isolate, hidden_private);
-  Local<Value> ext = jsobj->GetHiddenValue(hp);
-#else
-  Local<Value> ext = jsobj->GetHiddenValue(hidden_private);
-#endif
-  *data = ext.As<External>()->Value();
-  return TRUE;
+  va_list ap;
+  va_start(ap, msg);
+  SHIM__HANDLE_TYPE err = shim::shim_format_error(ctx, SHIM_ERR_ERROR, msg, ap);
+  va_end(ap);
+  return shim_val_new(ctx, err);
 }
 
 /**
- * \param ctx The currently executing context
- * \param val The the given object
- * \return The created persistent
+ * \param ctx Currently executing context
+ * \param msg The message to be used for error
+ * \param ... Arguments for formatting
+ * \return The wrapped TypeError
  */
-shim_persistent_t*
-shim_persistent_new(shim_ctx_s* ctx, shim_val_s* val)
+shim_val_s*
+shim_error_type_new(shim_ctx_s* ctx, const char* msg, ...)
 {
-  shim_persistent_s *p = new shim_persistent_s;
-#if NODE_VERSION_AT_LEAST(0, 11, 9)
-  p->handle.Reset(ctx->isolate, val->handle);
-#else
-  p->handle = Persistent<Value>::New(val->handle);
-#endif
-  return p;
+  va_list ap;
+  va_start(ap, msg);
+  SHIM__HANDLE_TYPE err = shim::shim_format_error(ctx, SHIM_ERR_TYPE, msg, ap);
+  va_end(ap);
+  return shim_val_new(ctx, err);
 }
 
 /**
- * \param val The persistent to dispose
+ * \param ctx Currently executing context
+ * \param msg The message to be used for error
+ * \param ... Arguments for formatting
+ * \return The wrapped RangeError
  */
-void
-shim_persistent_dispose(shim_persistent_s* val)
+shim_val_s*
+shim_error_range_new(shim_ctx_s* ctx, const char* msg, ...)
 {
-#if NODE_VERSION_AT_LEAST(0, 11, 11)
-  val->handle.Reset();
-#else
-  val->handle.Dispose();
-#endif
-  delete val;
+  va_list ap;
+  va_start(ap, msg);
+  SHIM__HANDLE_TYPE err = shim::shim_format_error(ctx, SHIM_ERR_RANGE, msg, ap);
+  va_end(ap);
+  return shim_val_new(ctx, err);
 }
 
-
+/**
+ * \param ctx Currently executing context
+ * \return TRUE if an exception is pending, otherwise FALSE
+ */
 shim_bool_t
-shim_persistent_to_val(shim_ctx_s* ctx, shim_persistent_s* pval, shim_val_s** val)
+shim_exception_pending(shim_ctx_s* ctx)
 {
-#if NODE_VERSION_AT_LEAST(0, 11, 9)
-  *val = new shim_val_s(PersistentToLocal(ctx->isolate, pval->handle));
-#else
-  *val = new shim_val_s(Local<Value>::New(pval->handle));
-#endif
-  return TRUE;
+  TryCatch* trycatch = static_cast<TryCatch*>(ctx->trycatch);
+  return trycatch->HasCaught();
 }
 
-#if NODE_VERSION_AT_LEAST(0, 11, 11)
-void
-common_weak_cb(const v8::WeakCallbackData<Value, weak_baton_t>& data)
-{
-  SHIM_PROLOGUE(ctx);
-  SHIM_CTX(ctx);
-
-  weak_baton_t* baton = data.GetParameter();
-  baton->weak_cb(&ctx, baton->persistent, baton->data);
-  delete baton;
-}
-#else
+/**
+ * \param ctx Currently executing context
+ * \param val The error to use as the pending exception
+ */
 void
-#if NODE_VERSION_AT_LEAST(0, 11, 3)
-common_weak_cb(Isolate* iso, Persistent<Value>* pobj, weak_baton_t* baton)
-{
-#else
-common_weak_cb(Persistent<Value> obj, void* data)
+shim_exception_set(shim_ctx_s* ctx, shim_val_s* val)
 {
-  weak_baton_t* baton = static_cast<weak_baton_t*>(data);
+#if NODE_VERSION_AT_LEAST(0, 11, 11)
+  ctx->isolate->
 #endif
 
-  SHIM_PROLOGUE(ctx);
-  SHIM_CTX(ctx);
-
-  baton->weak_cb(&ctx, baton->persistent, baton->data);
-  delete baton;
+  ThrowException(val->handle);
 }
-#endif
 
 /**
  * \param ctx Currently executing context
- * \param val Persistent to make weak
- * \param data Arbitrary data to pass to the weak_cb
- * \param weak_cb Callback that will be called when the object is about to be
- * free
+ * \param rval The currently pending exception
+ * \return TRUE if there was an exception, otherwise FALSE
  */
-void
-shim_obj_make_weak(shim_ctx_s* ctx, shim_persistent_s* val, void* data,
-  shim_weak_cb weak_cb)
+shim_bool_t
+shim_exception_get(shim_ctx_s* ctx, shim_val_s** rval)
 {
-  weak_baton_s *baton = new weak_baton_t;
-  baton->weak_cb = weak_cb;
-  baton->data = data;
-  baton->persistent = val;
-
-#if NODE_VERSION_AT_LEAST(0, 11, 11)
-  val->handle.SetWeak(baton, common_weak_cb);
-#else
-  val->handle.MakeWeak(baton, common_weak_cb);
-#endif
+  *rval = shim_val_new(ctx, ctx->trycatch->Exception());
+  return TRUE;
 }
 
 /**
- * \param val The given persistent
+ * \param ctx Currently executing context
  */
 void
-shim_obj_clear_weak(shim_persistent_s* val)
+shim_exception_clear(shim_ctx_s* ctx)
 {
-  val->handle.ClearWeak();
+  ctx->trycatch->Reset();
 }
 
 /**
  * \param ctx Currently executing context
- * \param cfunc The function pointer to be executed
- * \param argc The number of arguments the function takes
- * \param flags The flags for the function
- * \param name The name of the function
- * \param hint Arbitrary data to keep associated with the function
- * \return The wrapped function
+ * \param msg The message to set as the pending exception
+ * \param ... Arguments for formatting
  */
-shim_val_s*
-shim_func_new(shim_ctx_s* ctx, shim_func cfunc, size_t argc, int32_t flags,
-  const char* name, void* hint)
+void
+shim_throw_error(shim_ctx_s* ctx, const char* msg, ...)
 {
-  shim_fholder_s* holder = new shim_fholder_s;
-  holder->cfunc = cfunc;
-  holder->data = hint;
-
+  va_list ap;
+  va_start(ap, msg);
 #if NODE_VERSION_AT_LEAST(0, 11, 11)
-  Local<External> ext = External::New(ctx->isolate, reinterpret_cast<void*>(holder));
-  Local<FunctionTemplate> ft = FunctionTemplate::New(ctx->isolate, shim::Static, ext);
-#else
-  Local<External> ext = External::New(reinterpret_cast<void*>(holder));
-  Local<FunctionTemplate> ft = FunctionTemplate::New(shim::Static, ext);
+  ctx->isolate->
 #endif
-
-  Local<Function> fh = ft->GetFunction();
-  fh->SetName(NewSymbol(ctx, name));
-  return new shim_val_s(fh);
+  ThrowException(shim::shim_format_error(ctx, SHIM_ERR_ERROR, msg, ap));
+  va_end(ap);
 }
 
 /**
  * \param ctx Currently executing context
- * \param self The this parameter of the function call
- * \param sym The symbol representing the name of the function
- * \param argc The number of args to pass the function
- * \param argv The array of arguments to pass to the function
- * \param rval The return value of the function
- * \return TRUE if the function succeeded, otherwise FALSE
+ * \param msg The message to set as the pending exception
+ * \param ... Arguments for formatting
  */
-shim_bool_t
-shim_func_call_sym(shim_ctx_s* ctx, shim_val_s* self, shim_val_s* sym,
-  size_t argc, shim_val_s** argv, shim_val_s** rval)
+void
+shim_throw_type_error(shim_ctx_s* ctx, const char* msg, ...)
 {
-  assert(self != NULL);
-  Local<Object> recv = OBJ_TO_OBJECT(SHIM__TO_LOCAL(self->handle));
-
-  Local<String> str = OBJ_TO_STRING(SHIM__TO_LOCAL(sym->handle));
-  Handle<Value> ret = shim_call_func(ctx, recv, str, argc, argv);
-
-  if (rval != NULL)
-    *rval = new shim_val_s(ret);
-
-  return !ctx->trycatch->HasCaught();
+  va_list ap;
+  va_start(ap, msg);
+#if NODE_VERSION_AT_LEAST(0, 11, 11)
+  ctx->isolate->
+#endif
+  ThrowException(shim::shim_format_error(ctx, SHIM_ERR_TYPE, msg, ap));
+  va_end(ap);
 }
 
 /**
  * \param ctx Currently executing context
- * \param self The this parameter of the function call
- * \param name The name of the function
- * \param argc The number of args to pass the function
- * \param argv The array of arguments to pass to the function
- * \param rval The return value of the function
- * \return TRUE if the function succeeded, otherwise FALSE
+ * \param msg The message to set as the pending exception
+ * \param ... Arguments for formatting
  */
-shim_bool_t
-shim_func_call_name(shim_ctx_s* ctx, shim_val_s* self, const char* name,
-  size_t argc, shim_val_s** argv, shim_val_s** rval)
+void
+shim_throw_range_error(shim_ctx_s* ctx, const char* msg, ...)
 {
-  assert(self != NULL);
-  Local<Object> recv = OBJ_TO_OBJECT(SHIM__TO_LOCAL(self->handle));
-
-  Handle<Value> ret = shim_call_func(ctx, recv, NewSymbol(ctx, name), argc, argv);
-
-  if (rval != NULL)
-    *rval = new shim_val_s(ret);
-
-  return !ctx->trycatch->HasCaught();
+  va_list ap;
+  va_start(ap, msg);
+#if NODE_VERSION_AT_LEAST(0, 11, 11)
+  ctx->isolate->
+#endif
+  ThrowException(shim::shim_format_error(ctx, SHIM_ERR_RANGE, msg, ap));
+  va_end(ap);
 }
 
 /**
  * \param ctx Currently executing context
- * \param self The this parameter of the function call
- * \param func The function to be called
- * \param argc The number of args to pass the function
- * \param argv The array of arguments to pass to the function
- * \param rval The return value of the function
- * \return TRUE if the function succeeded, otherwise FALSE
+ * \param arg Given wrapped value
+ * \param type The destination type
+ * \param rval The pointer to where the data will be stored
+ * \return TRUE if it was able to convert, otherwise FALSE
+ *
+ * ArrayBuffers and typed arrays are stored to a ::shim_buffer_view_t, so the
+ * memory always comes with its length and element type.
  */
 shim_bool_t
-shim_func_call_val(shim_ctx_s* ctx, shim_val_s* self, shim_val_s* func,
-  size_t argc, shim_val_s** argv, shim_val_s** rval)
+shim_unpack_type(shim_ctx_s* ctx, shim_val_s* arg, shim_type_t type,
+  void* rval)
 {
-  SHIM__HANDLE_TYPE fh = func->handle;
-  assert(fh->IsFunction());
-  Local<Function> fn = SHIM__TO_LOCAL(fh).As<Function>();
-
-  Local<Object> recv;
+  if (!shim_value_is(arg, type))
+    return FALSE;
 
-  if (self != NULL)
-    recv = OBJ_TO_OBJECT(SHIM__TO_LOCAL(self->handle));
-  else
-#if NODE_VERSION_AT_LEAST(0, 11, 11)
-    recv = Object::New(ctx->isolate);
-#else
-    recv = Object::New();
-#endif
+  Local<Value> val = SHIM__TO_LOCAL(arg->handle);
 
-  Handle<Value> ret = shim_call_func(ctx, recv, fn, argc, argv);
+  shim_val_s** srval = static_cast<shim_val_s**>(rval);
+  shim_buffer_view_t* view;
 
-  if (rval != NULL)
-    *rval = new shim_val_s(ret);
+  switch(type) {
+    case SHIM_TYPE_BOOL:
+      *(shim_bool_t*)rval = val->BooleanValue();
+      break;
+    case SHIM_TYPE_INTEGER:
+      *(int64_t*)rval = val->IntegerValue();
+      break;
+    case SHIM_TYPE_UINT32:
+      *(uint32_t*)rval = val->Uint32Value();
+      break;
+    case SHIM_TYPE_INT32:
+      *(int32_t*)rval = val->Int32Value();
+      break;
+    case SHIM_TYPE_NUMBER:
+      *(double*)rval = val->NumberValue();
+      break;
+    case SHIM_TYPE_EXTERNAL:
+      *(void**)rval = shim_external_value(ctx, arg);
+      break;
+    case SHIM_TYPE_BUFFER:
+      *(char**)rval = shim_buffer_value(arg);
+      break;
+    case SHIM_TYPE_ARRAY_BUFFER:
+      view = static_cast<shim_buffer_view_t*>(rval);
+      view->data = shim_array_buffer_value(arg, &view->len);
+      view->type = SHIM_TYPED_UINT8;
+      break;
+    case SHIM_TYPE_TYPED_ARRAY:
+      view = static_cast<shim_buffer_view_t*>(rval);
+      view->data = shim_typed_array_value(arg, &view->len, &view->type);
+      break;
+    case SHIM_TYPE_STRING:
+      *srval = shim_val_new(ctx, OBJ_TO_STRING(val), SHIM_TYPE_STRING);
+      SHIM_DEBUG("allocating string at location %p with dest %p\n", srval, *srval);
+      break;
+    case SHIM_TYPE_FUNCTION:
+      *srval = shim_val_new(ctx, val, SHIM_TYPE_FUNCTION);
+      break;
+    case SHIM_TYPE_UNDEFINED:
+    case SHIM_TYPE_NULL:
+    case SHIM_TYPE_DATE:
+    case SHIM_TYPE_ARRAY:
+    case SHIM_TYPE_OBJECT:
+    default:
+      return FALSE;
+      break;
+  }
 
-  return !ctx->trycatch->HasCaught();
+  return TRUE;
 }
 
 /**
  * \param ctx Currently executing context
- * \param self The this parameter of the function call
- * \param sym The symbol representing the name of the function
- * \param argc The number of args to pass the function
- * \param argv The array of arguments to pass to the function
- * \param rval The return value of the function
- * \return TRUE if the function succeeded, otherwise FALSE
+ * \param args Arguments passed to the function
+ * \param idx Index of the argument to unpack
+ * \param type The destination type
+ * \param rval The pointer to the destination
+ * \return TRUE if it was able to unpack, otherwise FALSE
  */
 shim_bool_t
-shim_make_callback_sym(shim_ctx_s* ctx, shim_val_s* self, shim_val_s* sym,
-  size_t argc, shim_val_s** argv, shim_val_s** rval)
+shim_unpack_one(shim_ctx_s* ctx, shim_args_t* args, uint32_t idx,
+  shim_type_t type, void* rval)
 {
-  assert(self != NULL);
-
-  Local<Object> recv = OBJ_TO_OBJECT(SHIM__TO_LOCAL(self->handle));
-  Local<String> jsym = OBJ_TO_STRING(SHIM__TO_LOCAL(sym->handle));
-
-  SHIM__HANDLE_TYPE* jsargs = shim_vals_to_handles(ctx, argc, argv);
-
-#if NODE_VERSION_AT_LEAST(0, 11, 11)
-  Handle<Value> ret = node::MakeCallback(ctx->isolate, recv, jsym, argc, jsargs);
-#else
-  Handle<Value> ret = node::MakeCallback(recv, jsym, argc, jsargs);
-#endif
-
-  delete jsargs;
-
-  if (rval != NULL)
-    *rval = new shim_val_s(ret);
-
-  return !ctx->trycatch->HasCaught();
+  shim_val_s* arg = shim::shim_args_at(args, idx);
+  return shim::shim_unpack_type(ctx, arg, type, rval);
 }
 
 /**
  * \param ctx Currently executing context
- * \param self The this parameter of the function call
- * \param fval The function to call
- * \param argc The number of args to pass the function
- * \param argv The array of arguments to pass to the function
- * \param rval The return value of the function
- * \return TRUE if the function succeeded, otherwise FALSE
+ * \param args Arguments passed to the function
+ * \param type The first type to unpack
+ * \return TRUE if all desired arguments were able to be unpacked, otherwise
+ * FALSE
+ *
+ * Arguments are passed in pairs of shim_type_t and a pointer to their
+ * destination, you end the set of pairs by a single SHIM_TYPE_UNKNOWN.
+ *
+ * In the event an argument was unable to be unpacked, FALSE is returned and
+ * an exception is set.
  */
 shim_bool_t
-shim_make_callback_val(shim_ctx_s* ctx, shim_val_s* self, shim_val_s* fval,
-  size_t argc, shim_val_s** argv, shim_val_s** rval)
+shim_unpack(shim_ctx_s* ctx, shim_args_t* args, shim_type_t type, ...)
 {
-  /* TODO check is valid */
-  SHIM__HANDLE_TYPE prop = fval->handle;
-  Local<Function> fn = Local<Function>::Cast(SHIM__TO_LOCAL(prop));
-  SHIM__HANDLE_TYPE* jsargs = shim_vals_to_handles(ctx, argc, argv);
+  size_t cur;
+  shim_type_t ctype = type;
+  shim_bool_t ret = TRUE;
+  va_list ap;
 
-  Local<Object> recv;
+  va_start(ap, type);
 
-  if (self != NULL) {
-    recv = OBJ_TO_OBJECT(SHIM__TO_LOCAL(self->handle));
-  } else {
-#if NODE_VERSION_AT_LEAST(0, 11, 11)
-    recv = Object::New(ctx->isolate);
-#else
-    recv = Object::New();
-#endif
-  }
+  for (cur = 0, ctype = type; ctype != SHIM_TYPE_UNKNOWN && cur < args->argc; cur++)
+  {
+    void* rval = va_arg(ap, void*);
 
-#if NODE_VERSION_AT_LEAST(0, 11, 11)
-  Handle<Value> ret = node::MakeCallback(ctx->isolate, recv, fn, argc, jsargs);
-#else
-  Handle<Value> ret = node::MakeCallback(recv, fn, argc, jsargs);
-#endif
+    SHIM_DEBUG("SHIM UNPACK argument %lu/%lu of type %s and location %p\n",
+      cur, args->argc, shim_type_str(ctype), rval);
+    if(!shim::shim_unpack_type(ctx, shim::shim_args_at(args, cur), ctype,
+                               rval)) {
+      /* TODO this should use a type string */
+      shim::shim_throw_type_error(ctx, "Argument %d not of type %s",
+        static_cast<int>(cur), shim_type_str(ctype));
+      ret = FALSE;
+    }
 
-  delete jsargs;
+    if (ret == FALSE)
+      break;
 
-  if (rval != NULL)
-    *rval = new shim_val_s(ret);
+    ctype = static_cast<shim_type_t>(va_arg(ap, int));
+  }
 
-  return !ctx->trycatch->HasCaught();
+  va_end(ap);
+
+  return ret;
 }
 
 /**
  * \param ctx Currently executing context
- * \param obj The this parameter of the function call
- * \param name The name of the function
- * \param argc The number of args to pass the function
- * \param argv The array of arguments to pass to the function
- * \param rval The return value of the function
- * \return TRUE if the function succeeded, otherwise FALSE
+ * \param args Arguments passed to the function
+ * \param fmt The format describing the arguments
+ * \return TRUE if all desired arguments were able to be unpacked, otherwise
+ * FALSE
+ *
+ * Each character of the format unpacks one argument into the pointer passed
+ * in the same position:
+ *
+ *  - `b` shim_bool_t
+ *  - `i` int32_t
+ *  - `u` uint32_t
+ *  - `l` int64_t
+ *  - `d` double
+ *  - `e` void* of an external
+ *  - `B` char* of a buffer
+ *  - `A` shim_buffer_view_t of an ArrayBuffer, its length in bytes
+ *  - `T` shim_buffer_view_t of a typed array, its length in elements
+ *  - `s` shim_val_t* of a string
+ *  - `f` shim_val_t* of a function
+ *
+ * The format is parsed once and cached by its contents, so formats built at
+ * runtime are fine as long as there are only a handful of them. A call site
+ * passing the same format again is found by its address, and only has to
+ * confirm the format is unchanged.
+ *
+ * In the event an argument was unable to be unpacked, FALSE is returned and
+ * an exception is set.
  */
-shim_bool_t
-shim_make_callback_name(shim_ctx_s* ctx, shim_val_s* obj, const char* name,
-  size_t argc, shim_val_s** argv, shim_val_s** rval)
+int
+shim_unpack_fmt(shim_ctx_s* ctx, shim_args_t* args, const char* fmt, ...)
 {
-  assert(obj != NULL);
+  const shim_fmt_s* prog = shim::shim_fmt_compile(ctx, fmt);
 
-  SHIM__HANDLE_TYPE* jsargs = shim_vals_to_handles(ctx, argc, argv);
-  Local<Object> recv = OBJ_TO_OBJECT(SHIM__TO_LOCAL(obj->handle));
+  if (prog == NULL)
+    return FALSE;
 
-#if NODE_VERSION_AT_LEAST(0, 11, 11)
-  Handle<Value> ret = node::MakeCallback(ctx->isolate, recv, name, argc, jsargs);
-#else
-  Handle<Value> ret = node::MakeCallback(recv, name, argc, jsargs);
-#endif
+  size_t count = prog->len < args->argc ? prog->len : args->argc;
+  shim_bool_t ret = TRUE;
+  va_list ap;
 
-  delete jsargs;
+  /* a nested unpack may evict the program, so work from a copy */
+  uint8_t types_inline[SHIM_FMT_INLINE];
+  uint8_t* types = types_inline;
 
-  if (rval != NULL)
-    *rval = new shim_val_s(ret);
+  if (count > SHIM_FMT_INLINE)
+    types = static_cast<uint8_t*>(shim::shim_arena_alloc(ctx->allocs, count));
 
-  return !ctx->trycatch->HasCaught();
+  memcpy(types, prog->types, count);
+
+  va_start(ap, fmt);
+
+  for (size_t cur = 0; cur < count; cur++) {
+    shim_type_t type = static_cast<shim_type_t>(types[cur]);
+    void* rval = va_arg(ap, void*);
+
+    if (!shim::shim_unpack_type(ctx, shim::shim_args_at(args, cur), type,
+                                rval)) {
+      shim::shim_throw_type_error(ctx, "Argument %d not of type %s",
+        static_cast<int>(cur), shim_type_str(type));
+      ret = FALSE;
+      break;
+    }
+  }
+
+  va_end(ap);
+
+  return ret;
 }
 
 /**
- * \param ctx Current executing context
- * \param d The value of the new number
- * \return The wrapped number
+ * \param args The arguments passed to the function
+ * \return The amount of arguments passed to the function
  */
-shim_val_s*
-shim_number_new(shim_ctx_s* ctx, double d)
+size_t
+shim_args_length(shim_args_t* args)
 {
-#if NODE_VERSION_AT_LEAST(0, 11, 11)
-  return new shim_val_s(Number::New(ctx->isolate, d));
-#else
-  return new shim_val_s(Number::New(d));
-#endif
+  return args->argc;
 }
 
 /**
- * \param val The given number
- * \return The value of the number
+ * \param args The arguments passed to the function
+ * \param idx The index of the desired argument
+ * \return The wrapped argument
  */
-double
-shim_number_value(shim_val_s* val)
+shim_val_s*
+shim_args_get(shim_args_t* args, size_t idx)
 {
-  return val->handle->NumberValue();
+  return shim::shim_args_at(args, idx);
 }
 
 /**
- * \param ctx Current executing context
- * \param i The value of the new integer
- * \return The wrapped integer
+ * \param ctx Currently executing context
+ * \param args The arguments passed to the function
+ * \param val The value to use for return
+ * \return TRUE if it was able to set the return value, otherwise FALSE
  */
-shim_val_s*
-shim_integer_new(shim_ctx_s* ctx, int32_t i)
+shim_bool_t
+shim_args_set_rval(shim_ctx_s* ctx, shim_args_t* args, shim_val_s* val)
 {
-#if NODE_VERSION_AT_LEAST(0, 11, 11)
-  return new shim_val_s(Integer::New(ctx->isolate, i));
-#else
-  return new shim_val_s(Integer::New(i));
-#endif
+  /* TODO check if persistent */
+  /*
+  if (!shim_has_allocd(ctx, val))
+    allocs_from_ctx(ctx)->insert(val);
+  */
+  args->ret = val;
+  return TRUE;
 }
 
 /**
- * \param ctx Current executing context
- * \param i The value of the new integer
- * \return The wrapped integer
+ * \param ctx Currently executing context
+ * \param args The arguments passed to the function
+ * \return The `this` associated with the executing function
  */
 shim_val_s*
-shim_integer_uint(shim_ctx_s* ctx, uint32_t i)
+shim_args_get_this(shim_ctx_s* ctx, shim_args_t* args)
 {
-#if NODE_VERSION_AT_LEAST(0, 11, 11)
-  return new shim_val_s(Integer::NewFromUnsigned(ctx->isolate, i));
-#else
-  return new shim_val_s(Integer::NewFromUnsigned(i));
-#endif
+  return args->self;
 }
 
 /**
- * \param val The given integer
- * \return The value of the integer
+ * \param ctx Currently executing context
+ * \param args The arguments passed to the function
+ * \return Pointer to the arbitrary data associated with the executing function
  */
-int64_t
-shim_integer_value(shim_val_s* val)
+void*
+shim_args_get_data(shim_ctx_s* ctx, shim_args_t* args)
 {
-  return val->handle->IntegerValue();
+  return args->data;
 }
 
-/**
- * \param val The given integer
- * \return The int32_t value of the integer
+
+/* records are only handed out and recycled on the loop thread */
+shim_work_s* work_pool = NULL;
+size_t work_pool_len = 0;
+size_t work_pool_limit = SHIM_WORK_POOL_MAX;
+size_t work_pool_hits = 0;
+size_t work_pool_misses = 0;
+
+/*
+ * Handles name a slot rather than the record, which is recycled or freed,
+ * the generation is bumped whenever a slot is given up so a stale handle
+ * never matches the job that reuses it
  */
-int32_t
-shim_integer_int32_value(shim_val_s* val)
+struct shim_work_slot_s {
+  shim_work_s* work;
+  uint32_t gen;
+  uint32_t next;
+};
+
+shim_work_slot_s* work_slots = NULL;
+uint32_t work_slots_len = 0;
+uint32_t work_slots_free = SHIM_WORK_NO_SLOT;
+
+
+shim_work_s*
+work_alloc()
 {
-  return val->handle->Int32Value();
+  shim_work_s* work = work_pool;
+
+  if (work != NULL) {
+    work_pool = work->next;
+    work_pool_len--;
+    work_pool_hits++;
+  } else {
+    work = new shim_work_s;
+    work_pool_misses++;
+  }
+
+  work->next = NULL;
+  return work;
 }
 
-/**
- * \param val The given integer
- * \return The uint32_t value of the integer
- */
-uint32_t
-shim_integer_uint32_value(shim_val_s* val)
+
+shim_work_handle_t
+work_handle(shim_work_s* work)
 {
-  return val->handle->Uint32Value();
+  uint32_t slot = work_slots_free;
+
+  if (slot == SHIM_WORK_NO_SLOT) {
+    uint32_t len = work_slots_len == 0 ? 64 : work_slots_len * 2;
+
+    shim_work_slot_s* slots = static_cast<shim_work_slot_s*>(
+      realloc(work_slots, sizeof(shim_work_slot_s) * len));
+
+    /* a handle has to be returned, like the arena we can only give up */
+    if (slots == NULL) {
+      fprintf(stderr, "shim: work handles out of memory (%lu slots)\n",
+        static_cast<unsigned long>(len));
+      abort();
+    }
+
+    work_slots = slots;
+
+    for (uint32_t i = work_slots_len; i < len; i++) {
+      work_slots[i].work = NULL;
+      work_slots[i].gen = 0;
+      work_slots[i].next = i + 1 < len ? i + 1 : SHIM_WORK_NO_SLOT;
+    }
+
+    slot = work_slots_len;
+    work_slots_len = len;
+  }
+
+  work_slots_free = work_slots[slot].next;
+  work_slots[slot].work = work;
+  work->slot = slot;
+
+  shim_work_handle_t handle;
+  handle.slot = slot;
+  handle.gen = work_slots[slot].gen;
+  return handle;
 }
 
-/**
- * \param ctx Current executing context
- * \return Wrapped empty string
- */
-shim_val_s*
-shim_string_new(shim_ctx_s* ctx)
+
+void
+work_free(shim_work_s* work)
 {
-#if NODE_VERSION_AT_LEAST(0, 11, 11)
-  return new shim_val_s(String::Empty(ctx->isolate));
-#else
-  return new shim_val_s(String::Empty());
-#endif
+  if (work->slot != SHIM_WORK_NO_SLOT) {
+    shim_work_slot_s* slot = &work_slots[work->slot];
+    slot->work = NULL;
+    slot->gen++;
+    slot->next = work_slots_free;
+    work_slots_free = work->slot;
+  }
+
+  if (work_pool_len >= work_pool_limit) {
+    delete work;
+    return;
+  }
+
+  work->next = work_pool;
+  work_pool = work;
+  work_pool_len++;
 }
 
-/**
- * \param ctx Current executing context
- * \param data Source null terminated string
- * \return The wrapped string
- */
-shim_val_s*
-shim_string_new_copy(shim_ctx_s* ctx, const char* data)
+
+void
+before_work(uv_work_t* req)
 {
-#if NODE_VERSION_AT_LEAST(0, 11, 11)
-  return new shim_val_s(String::NewFromUtf8(ctx->isolate, data));
+  shim_work_t* work = container_of(req, shim_work_t, req);
+  work->work_cb(work, work->hint);
+}
+
+
+void
+progress_closed(uv_handle_t* handle)
+{
+  shim_progress_s* progress = container_of(handle, shim_progress_s, async);
+
+  uv_mutex_destroy(&progress->lock);
+  free(progress->data);
+  free(progress->spare);
+  delete progress;
+}
+
+
+void
+progress_deliver(shim_ctx_s* ctx, shim_progress_s* progress)
+{
+  char* data;
+  size_t len;
+  size_t size;
+
+  /* swap buffers so the worker keeps appending while we call out */
+  uv_mutex_lock(&progress->lock);
+  data = progress->data;
+  len = progress->len;
+  size = progress->size;
+  progress->data = progress->spare;
+  progress->size = progress->spare_size;
+  progress->len = 0;
+  progress->spare = data;
+  progress->spare_size = size;
+  uv_mutex_unlock(&progress->lock);
+
+  if (len > 0)
+    progress->progress_cb(ctx, progress->work, data, len,
+      progress->work->hint);
+}
+
+
+/* a completion or progress callback that threw is reported like any other uncaught exception */
+void
+work_fatal(shim_ctx_s* ctx, TryCatch& trycatch)
+{
+#if NODE_VERSION_AT_LEAST(0, 11, 13)
+  node::FatalException(ctx->isolate, trycatch);
 #else
-  return new shim_val_s(String::New(data));
+  node::FatalException(trycatch);
 #endif
 }
 
-/**
- * \param ctx Current executing context
- * \param data Source string
- * \param len Length of created string
- * \return The wrapped string
- */
-shim_val_s*
-shim_string_new_copyn(shim_ctx_s* ctx, const char* data, size_t len)
-{
-#if NODE_VERSION_AT_LEAST(0, 11, 11)
-  return new shim_val_s(String::NewFromUtf8(ctx->isolate,
-                          data,
-                          String::kNormalString,
-                          len));
+
+/* everything published since the last turn arrives as one delivery */
+void
+#if NODE_VERSION_AT_LEAST(0, 11, 13)
+progress_async(uv_async_t* handle)
 #else
-  return new shim_val_s(String::New(data, len));
+progress_async(uv_async_t* handle, int status)
 #endif
+{
+  shim_progress_s* progress = container_of(handle, shim_progress_s, async);
+
+  SHIM_PROLOGUE(ctx);
+  SHIM_CTX(ctx);
+  progress_deliver(&ctx, progress);
+  if (ctx_trycatch.HasCaught())
+    work_fatal(&ctx, ctx_trycatch);
+  shim_context_cleanup(&ctx);
 }
 
-/**
- * \param val The given string
- * \return The length of the string
- */
-size_t
-shim_string_length(shim_val_s* val)
+
+/* the tail of the progress always reaches javascript before after_cb */
+void
+progress_finish(shim_ctx_s* ctx, shim_work_s* work)
 {
-  return OBJ_TO_STRING(val->handle)->Length();
+  shim_progress_s* progress = work->progress;
+
+  if (progress == NULL)
+    return;
+
+  progress_deliver(ctx, progress);
+  uv_close(reinterpret_cast<uv_handle_t*>(&progress->async), progress_closed);
+  work->progress = NULL;
 }
 
-/**
- * \param val The given string
- * \return The length of the UTF-8 encoded string
- */
-size_t
-shim_string_length_utf8(shim_val_s* val)
+
+void
+work_complete(shim_work_s* work, int status)
 {
-  return OBJ_TO_STRING(val->handle)->Utf8Length();
+  SHIM_PROLOGUE(ctx);
+  SHIM_CTX(ctx);
+  progress_finish(&ctx, work);
+  work->after_cb(&ctx, work, status, work->hint);
+  if (ctx_trycatch.HasCaught())
+    work_fatal(&ctx, ctx_trycatch);
+  shim_context_cleanup(&ctx);
+  work_free(work);
 }
 
-/**
- * \param val The given string
- * \return The C string value of the string
- *
- * The caller is responsible for free'ing this memory
- */
-char*
-shim_string_value(shim_val_s* val)
+
+#if NODE_VERSION_AT_LEAST(0, 10, 0)
+/* finished jobs from any thread land on this stack */
+uv_mutex_t done_lock;
+shim_work_s* done_head = NULL;
+/* the rest is only touched on the loop thread */
+QUEUE done_queue;
+uv_async_t done_async;
+uv_check_t done_check;
+bool done_started = false;
+size_t done_pending = 0;
+size_t done_max = SHIM_WORK_DRAIN_MAX;
+
+
+void
+done_push(shim_work_s* work)
 {
-  String::Utf8Value str(OBJ_TO_STRING(val->handle));
-  return strdup(*str);
+  uv_mutex_lock(&done_lock);
+  work->next = done_head;
+  done_head = work;
+  uv_mutex_unlock(&done_lock);
+
+  uv_async_send(&done_async);
 }
 
-/**
- * \param val The given string
- * \param buff The destination buffer
- * \param start The starting position to encode
- * \param len The length of the string to create
- * \param options The options for how to encode the string
+
+/*
+ * Runs finished jobs inside a single scope, at most done_max of them per
+ * turn of the loop so a burst can't starve everything else
  */
-size_t
-shim_string_write_ascii(shim_val_s* val, char* buff, size_t start, size_t len,
-  int32_t options)
+void
+done_run()
 {
-  String str = **OBJ_TO_STRING(val->handle);
-#if NODE_VERSION_AT_LEAST(0, 11, 9)
-  return str.WriteOneByte(reinterpret_cast<uint8_t*>(buff), start, len);
+  if (QUEUE_EMPTY(&done_queue))
+    return;
+
+  SHIM_PROLOGUE(ctx);
+  SHIM_CTX(ctx);
+
+  for (size_t n = 0; n < done_max && !QUEUE_EMPTY(&done_queue); n++) {
+    QUEUE* q = static_cast<QUEUE*>(QUEUE_HEAD(&done_queue));
+    QUEUE_REMOVE(q);
+
+    shim_work_s* work = QUEUE_DATA(q, shim_work_s, member);
+
+    if (work->flags & SHIM_WORK_COALESCE) {
+      progress_finish(&ctx, work);
+      work->after_cb(&ctx, work, work->status, work->hint);
+      /* every job starts clean, as if it had a scope of its own */
+      if (ctx_trycatch.HasCaught())
+        work_fatal(&ctx, ctx_trycatch);
+      ctx_trycatch.Reset();
+      shim_context_cleanup(&ctx);
+      work_free(work);
+    } else {
+      work_complete(work, work->status);
+    }
+
+    /* let the loop exit once nothing is in flight */
+    if (--done_pending == 0)
+      uv_unref(reinterpret_cast<uv_handle_t*>(&done_async));
+  }
+
+  if (!QUEUE_EMPTY(&done_queue))
+    uv_async_send(&done_async);
+}
+
+
+/* jobs finished on the addon pool wake the loop here */
+void
+#if NODE_VERSION_AT_LEAST(0, 11, 13)
+done_drain(uv_async_t* handle)
 #else
-  return str.WriteAscii(buff, start, len);
+done_drain(uv_async_t* handle, int status)
 #endif
+{
+  uv_mutex_lock(&done_lock);
+  shim_work_s* head = done_head;
+  done_head = NULL;
+  uv_mutex_unlock(&done_lock);
+
+  shim_work_s* fifo = NULL;
+
+  while (head != NULL) {
+    shim_work_s* next = head->next;
+    head->next = fifo;
+    fifo = head;
+    head = next;
+  }
+
+  for (; fifo != NULL; fifo = fifo->next)
+    QUEUE_INSERT_TAIL(&done_queue, &fifo->member);
+
+  done_run();
 }
 
-/**
- * \param ctx Current executing context
- * \param len Length of array to be created
- * \return Wrapped array
+
+/*
+ * libuv already woke the loop for jobs finishing on its threadpool, they're
+ * gathered while it runs their after callbacks and drained right after poll
  */
-shim_val_s*
-shim_array_new(shim_ctx_s* ctx, size_t len)
-{
-#if NODE_VERSION_AT_LEAST(0, 11, 11)
-  return new shim_val_s(Array::New(ctx->isolate, len));
+void
+#if NODE_VERSION_AT_LEAST(0, 11, 13)
+done_checked(uv_check_t* handle)
 #else
-  return new shim_val_s(Array::New(len));
+done_checked(uv_check_t* handle, int status)
 #endif
+{
+  uv_check_stop(&done_check);
+  done_run();
 }
 
-/**
- * \param arr Given array
- * \return Length of the array
- */
-size_t
-shim_array_length(shim_val_s* arr)
+
+void
+done_start()
 {
-  return OBJ_TO_ARRAY(SHIM__TO_LOCAL(arr->handle))->Length();
+  if (done_started)
+    return;
+
+  uv_mutex_init(&done_lock);
+  QUEUE_INIT(&done_queue);
+  uv_async_init(uv_default_loop(), &done_async, done_drain);
+  uv_unref(reinterpret_cast<uv_handle_t*>(&done_async));
+  uv_check_init(uv_default_loop(), &done_check);
+  done_started = true;
 }
 
-/**
- * \param ctx Current executing context
- * \param arr Given array
- * \param idx Index of element
- * \param rval Actual return value
- * \return TRUE if the value existed, otherwise FALSE
- */
-shim_bool_t
-shim_array_get(shim_ctx_s* ctx, shim_val_s* arr, int32_t idx, shim_val_s** rval)
+
+/* a job will be finishing through done_drain */
+void
+done_expect()
 {
-  *rval = new shim_val_s(OBJ_TO_ARRAY(SHIM__TO_LOCAL(arr->handle))->Get(idx));
-  return TRUE;
+  if (done_pending++ == 0)
+    uv_ref(reinterpret_cast<uv_handle_t*>(&done_async));
 }
+#endif
 
-/**
- * \param ctx Current executing context
- * \param arr Given array
- * \param idx Index of element
- * \param val Value to be set
- * \return TRUE if the value was able to be set, otherwise FALSE
- */
-shim_bool_t
-shim_array_set(shim_ctx_s* ctx, shim_val_s* arr, int32_t idx, shim_val_s* val)
+
+void
+#if NODE_VERSION_AT_LEAST(0, 10, 0)
+before_after(uv_work_t* req, int status)
 {
-  return OBJ_TO_ARRAY(SHIM__TO_LOCAL(arr->handle))->Set(idx, val->handle);
+#else
+before_after(uv_work_t* req)
+{
+  int status = 0;
+#endif
+  shim_work_t* work = container_of(req, shim_work_t, req);
+
+#if NODE_VERSION_AT_LEAST(0, 10, 0)
+  if (work->flags & SHIM_WORK_COALESCE) {
+    work->status = status;
+    done_expect();
+    QUEUE_INSERT_TAIL(&done_queue, &work->member);
+    uv_check_start(&done_check, done_checked);
+    return;
+  }
+#endif
+
+  work_complete(work, status);
 }
 
-/**
- * \param ctx Current executing context
- * \param len Size of buffer to create
- * \return Wrapped buffer
+
+#if NODE_VERSION_AT_LEAST(0, 10, 0)
+shim_worker_s* pool_workers = NULL;
+size_t pool_size = 0;
+uint32_t pool_flags = 0;
+/* only touched on the loop thread */
+size_t pool_next = 0;
+
+/*
+ * guards pool_queued, the count of jobs sitting in any worker's queue, and
+ * pool_seq, bumped with every submit so an idle worker can tell it missed one
  */
-shim_val_s*
-shim_buffer_new(shim_ctx_s* ctx, size_t len)
+uv_mutex_t pool_lock;
+uv_cond_t pool_cond;
+long pool_queued = 0;
+unsigned long pool_seq = 0;
+bool pool_stopping = false;
+bool pool_atexit_registered = false;
+
+
+bool
+work_pooled(uint32_t flags)
 {
-#if NODE_VERSION_AT_LEAST(0, 11, 3)
-  return new shim_val_s(node::Buffer::New(len));
-#else
-  return new shim_val_s(SHIM__TO_LOCAL(Buffer::New(len)->handle_));
-#endif
+  /* libuv's threadpool has no notion of priority */
+  return (flags & (SHIM_WORK_POOL | SHIM_WORK_PRIORITY_HIGH |
+    SHIM_WORK_PRIORITY_BACKGROUND)) != 0;
 }
 
-/**
- * \param ctx Current executing context
- * \param data Data to be copied
- * \param len Length of data to be copied
- * \return Wrapped buffer
- */
-shim_val_s*
-shim_buffer_new_copy(shim_ctx_s* ctx, const char* data, size_t len)
+
+size_t
+work_lane(uint32_t flags)
 {
-#if NODE_VERSION_AT_LEAST(0, 11, 3)
-  return new shim_val_s(node::Buffer::New(data, len));
-#elif NODE_VERSION_AT_LEAST(0, 10, 0)
-  return new shim_val_s(SHIM__TO_LOCAL(Buffer::New(data, len)->handle_));
-#else
-  return new shim_val_s(SHIM__TO_LOCAL(Buffer::New((char*)data, len)->handle_));
-#endif
+  if (flags & SHIM_WORK_PRIORITY_HIGH)
+    return 0;
+  if (flags & SHIM_WORK_PRIORITY_BACKGROUND)
+    return 2;
+  return 1;
 }
 
-/**
- * \param ctx Current executing context
- * \param data Data to be used for underlying memory
- * \param len Size of memory being used
- * \param cb Callback that is called when buffer is to be freed
- * \param hint Arbitrary data passed to the callback
- * \return Wrapped buffer
- *
- * The underlying memory is not copied, but used in place
- */
-shim_val_s*
-shim_buffer_new_external(shim_ctx_s* ctx, char* data, size_t len,
-  shim_buffer_free cb, void* hint)
+
+shim_work_s*
+pool_pop(shim_worker_s* worker, size_t lane, bool steal)
 {
-#if NODE_VERSION_AT_LEAST(0, 11, 3)
-  return new shim_val_s(node::Buffer::New(data, len, cb, hint));
-#else
-  Buffer* buf = Buffer::New(data, len, cb, hint);
-  shim_val_s* tmp = new shim_val_s(Local<Object>::New(buf->handle_));
-  return tmp;
-#endif
+  shim_work_s* work = NULL;
+  QUEUE* queue = &worker->lanes[lane];
+
+  uv_mutex_lock(&worker->lock);
+
+  if (!QUEUE_EMPTY(queue)) {
+    QUEUE* q = static_cast<QUEUE*>(steal ? QUEUE_PREV(queue)
+                                          : QUEUE_HEAD(queue));
+    QUEUE_REMOVE(q);
+    work = QUEUE_DATA(q, shim_work_s, member);
+    work->queued = false;
+  }
+
+  uv_mutex_unlock(&worker->lock);
+
+  return work;
 }
 
-/**
- * \param val THe given buffer
- * \return Pointer to the underlying memory
- */
-char*
-shim_buffer_value(shim_val_s* val)
+
+/* urgent jobs anywhere in the pool go before our own bulk work */
+shim_work_s*
+pool_take(shim_worker_s* self)
 {
-  Local<Value> v = SHIM__TO_LOCAL(val->handle);
+  shim_work_s* work = NULL;
 
-#if NODE_VERSION_AT_LEAST(0, 11, 3)
-  assert(node::Buffer::HasInstance(v));
-  return node::Buffer::Data(v);
-#elif NODE_VERSION_AT_LEAST(0, 10, 0)
-  assert(Buffer::HasInstance(v));
-  return Buffer::Data(v);
-#else
-  assert(Buffer::HasInstance(v));
-  return Buffer::Data(v.As<Object>());
-#endif
+  for (size_t lane = 0; work == NULL && lane < SHIM_WORK_LANES; lane++) {
+    work = pool_pop(self, lane, false);
+
+    for (size_t i = 1; work == NULL && i < pool_size; i++)
+      work = pool_pop(&pool_workers[(self->index + i) % pool_size], lane,
+        true);
+  }
+
+  if (work != NULL) {
+    uv_mutex_lock(&pool_lock);
+    pool_queued--;
+    uv_mutex_unlock(&pool_lock);
+  }
+
+  return work;
 }
 
-/**
- * \param val The given buffer
- * \return THe size of the buffer
- */
-size_t
-shim_buffer_length(shim_val_s* val)
+
+/* shim_pool_start refuses SHIM_POOL_PIN anywhere else */
+void
+pool_pin(shim_worker_s* self)
 {
-  Local<Value> v = SHIM__TO_LOCAL(val->handle);
+#if defined(__linux__)
+  long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
 
-#if NODE_VERSION_AT_LEAST(0, 11, 3)
-  assert(node::Buffer::HasInstance(v));
-  return node::Buffer::Length(v);
-#elif NODE_VERSION_AT_LEAST(0, 10, 0)
-  assert(Buffer::HasInstance(v));
-  return Buffer::Length(v);
-#else
-  assert(Buffer::HasInstance(v));
-  return Buffer::Length(v.As<Object>());
+  if (ncpu <= 0)
+    return;
+
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(self->index % ncpu, &set);
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
 #endif
 }
 
-/**
- * \param ctx Currently executing context
- * \param data The external data to wrap
- * \return Wrapped external
- *
- * This is an object that is safe to pass to and from JavaScript.
- * \sa persistents
- */
-shim_val_s*
-shim_external_new(shim_ctx_s* ctx, void* data)
+
+void
+pool_worker(void* arg)
 {
-#if NODE_VERSION_AT_LEAST(0, 11, 11)
-  Local<External> ext = External::New(ctx->isolate, data);
-#else
-  Local<External> ext = External::New(data);
-#endif
-  shim_val_s* ret;
+  shim_worker_s* self = static_cast<shim_worker_s*>(arg);
 
-#if NODE_VERSION_AT_LEAST(0, 11, 3)
-  ret = new shim_val_s(ext);
-#else
-  Local<Object> o = Object::New();
-  o->SetHiddenValue(hidden_private, ext);
-  ret = new shim_val_s(o, SHIM_TYPE_EXTERNAL);
-#endif
+  if (pool_flags & SHIM_POOL_PIN)
+    pool_pin(self);
 
-  return ret;
+  for (;;) {
+    uv_mutex_lock(&pool_lock);
+    while (pool_queued <= 0 && !pool_stopping)
+      uv_cond_wait(&pool_cond, &pool_lock);
+    bool stopping = pool_stopping;
+    unsigned long seq = pool_seq;
+    uv_mutex_unlock(&pool_lock);
+
+    if (stopping)
+      break;
+
+    shim_work_s* work = pool_take(self);
+
+    /*
+     * the count can be ahead of the queues while a cancel or another worker
+     * is between removing a job and uncounting it, sleep until a new submit
+     * rather than spin on it
+     */
+    if (work == NULL) {
+      uv_mutex_lock(&pool_lock);
+      while (pool_seq == seq && !pool_stopping)
+        uv_cond_wait(&pool_cond, &pool_lock);
+      uv_mutex_unlock(&pool_lock);
+      continue;
+    }
+
+    work->work_cb(work, work->hint);
+    work->status = 0;
+    done_push(work);
+  }
 }
 
-/**
- * \param ctx Currently executing context
- * \param obj The given external
- * \return The pointer to the wrapped memory
- */
-void*
-shim_external_value(shim_ctx_s* ctx, shim_val_s* obj)
-{
-  Local<Value> v(SHIM__TO_LOCAL(obj->handle));
 
-#if ! NODE_VERSION_AT_LEAST(0, 11, 3)
-  if (v->IsObject()) {
-    Handle<Object> o = v.As<Object>();
+/* Running jobs are finished but queued ones never start, they're cancelled */
+void
+pool_shutdown()
+{
+  uv_mutex_lock(&pool_lock);
+  pool_stopping = true;
+  uv_cond_broadcast(&pool_cond);
+  uv_mutex_unlock(&pool_lock);
+
+  for (size_t i = 0; i < pool_size; i++)
+    uv_thread_join(&pool_workers[i].thread);
+
+  for (size_t i = 0; i < pool_size; i++) {
+    shim_worker_s* worker = &pool_workers[i];
+
+    for (size_t lane = 0; lane < SHIM_WORK_LANES; lane++) {
+      while (!QUEUE_EMPTY(&worker->lanes[lane])) {
+        QUEUE* q = static_cast<QUEUE*>(QUEUE_HEAD(&worker->lanes[lane]));
+        QUEUE_REMOVE(q);
+
+        shim_work_s* work = QUEUE_DATA(q, shim_work_s, member);
+        work->queued = false;
+        work->status = SHIM__ECANCELED;
+        QUEUE_INSERT_TAIL(&done_queue, &work->member);
+      }
+    }
 
-    if (!o->IsUndefined() && !o.IsEmpty())
-      v = o->GetHiddenValue(hidden_private);
+    uv_mutex_destroy(&worker->lock);
   }
-#endif
 
-  if (v->IsUndefined() || !v->IsExternal())
-    return NULL;
-  else
-    return v.As<External>()->Value();
+  uv_async_send(&done_async);
+
+  uv_cond_destroy(&pool_cond);
+  uv_mutex_destroy(&pool_lock);
+
+  delete[] pool_workers;
+  pool_workers = NULL;
+  pool_size = 0;
+  pool_queued = 0;
+  pool_stopping = false;
 }
 
-/**
- * \param ctx Currently executing context
- * \param msg The message to be used for error
- * \param ... Arguments for formatting
- * \return The wrapped Error
+
+/*
+ * A job still running, or a blocked channel sender waiting on the loop, would
+ * hang exit if we joined, so the threads are only told to stop and then go
+ * down with the process
  */
-shim_val_s*
-shim_error_new(shim_ctx_s* ctx, const char* msg, ...)
+void
+pool_atexit()
 {
-  va_list ap;
-  va_start(ap, msg);
-  SHIM__HANDLE_TYPE err = shim::shim_format_error(ctx, SHIM_ERR_ERROR, msg, ap);
-  va_end(ap);
-  return new shim_val_s(err);
+  if (pool_size == 0)
+    return;
+
+  uv_mutex_lock(&pool_lock);
+  pool_stopping = true;
+  uv_cond_broadcast(&pool_cond);
+  uv_mutex_unlock(&pool_lock);
 }
 
-/**
- * \param ctx Currently executing context
- * \param msg The message to be used for error
- * \param ... Arguments for formatting
- * \return The wrapped TypeError
- */
-shim_val_s*
-shim_error_type_new(shim_ctx_s* ctx, const char* msg, ...)
+
+void
+pool_submit(shim_work_s* work)
 {
-  va_list ap;
-  va_start(ap, msg);
-  SHIM__HANDLE_TYPE err = shim::shim_format_error(ctx, SHIM_ERR_TYPE, msg, ap);
-  va_end(ap);
-  return new shim_val_s(err);
+  shim_worker_s* worker = &pool_workers[pool_next++ % pool_size];
+
+  uv_mutex_lock(&worker->lock);
+  work->owner = worker->index;
+  work->queued = true;
+  QUEUE_INSERT_TAIL(&worker->lanes[work_lane(work->flags)], &work->member);
+  uv_mutex_unlock(&worker->lock);
+
+  uv_mutex_lock(&pool_lock);
+  pool_queued++;
+  pool_seq++;
+  uv_cond_signal(&pool_cond);
+  uv_mutex_unlock(&pool_lock);
+
+  done_expect();
 }
+#endif
 
 /**
- * \param ctx Currently executing context
- * \param msg The message to be used for error
- * \param ... Arguments for formatting
- * \return The wrapped RangeError
+ * \param nthreads The number of threads, 0 for SHIM_POOL_DEFAULT_SIZE
+ * \param flags SHIM_POOL_PIN to pin each thread to a core
+ * \return 0 on success, otherwise -1 if the pool is already running, is
+ * unsupported on this version of node, or SHIM_POOL_PIN was asked for on a
+ * platform other than Linux
+ *
+ * Starts the addon layer's own thread pool which jobs queued with
+ * SHIM_WORK_POOL run on, keeping CPU heavy work from starving the libuv
+ * threadpool that fs and DNS requests share. If it hasn't been started when
+ * the first such job is queued it is started with the defaults.
+ *
+ * At exit the threads are told to stop but never waited for, so a job still
+ * running is cut off with the process. Call shim_pool_stop first to let
+ * running jobs finish.
  */
-shim_val_s*
-shim_error_range_new(shim_ctx_s* ctx, const char* msg, ...)
+int
+shim_pool_start(size_t nthreads, uint32_t flags)
 {
-  va_list ap;
-  va_start(ap, msg);
-  SHIM__HANDLE_TYPE err = shim::shim_format_error(ctx, SHIM_ERR_RANGE, msg, ap);
-  va_end(ap);
-  return new shim_val_s(err);
+#if NODE_VERSION_AT_LEAST(0, 10, 0)
+  if (pool_size != 0)
+    return -1;
+
+#if !defined(__linux__)
+  if (flags & SHIM_POOL_PIN)
+    return -1;
+#endif
+
+  if (nthreads == 0)
+    nthreads = SHIM_POOL_DEFAULT_SIZE;
+
+  uv_mutex_init(&pool_lock);
+  uv_cond_init(&pool_cond);
+  done_start();
+
+  pool_flags = flags;
+  pool_size = nthreads;
+  pool_workers = new shim_worker_s[nthreads];
+
+  for (size_t i = 0; i < nthreads; i++) {
+    shim_worker_s* worker = &pool_workers[i];
+    worker->index = i;
+    uv_mutex_init(&worker->lock);
+
+    for (size_t lane = 0; lane < SHIM_WORK_LANES; lane++)
+      QUEUE_INIT(&worker->lanes[lane]);
+  }
+
+  for (size_t i = 0; i < nthreads; i++)
+    uv_thread_create(&pool_workers[i].thread, pool_worker, &pool_workers[i]);
+
+  if (!pool_atexit_registered) {
+    atexit(pool_atexit);
+    pool_atexit_registered = true;
+  }
+
+  return 0;
+#else
+  return -1;
+#endif
 }
 
 /**
- * \param ctx Currently executing context
- * \return TRUE if an exception is pending, otherwise FALSE
+ * \return 0 on success, otherwise -1 if the pool isn't running
+ *
+ * Waits for the jobs the pool's threads are running to finish and joins
+ * them. Jobs still queued never start, their after_cb is called with the
+ * status used for cancelled jobs like shim_work_cancel. The pool may be
+ * started again afterwards.
  */
-shim_bool_t
-shim_exception_pending(shim_ctx_s* ctx)
+int
+shim_pool_stop(void)
 {
-  TryCatch* trycatch = static_cast<TryCatch*>(ctx->trycatch);
-  return trycatch->HasCaught();
+#if NODE_VERSION_AT_LEAST(0, 10, 0)
+  if (pool_size == 0)
+    return -1;
+
+  pool_shutdown();
+
+  return 0;
+#else
+  return -1;
+#endif
 }
 
-/**
- * \param ctx Currently executing context
- * \param val The error to use as the pending exception
- */
 void
-shim_exception_set(shim_ctx_s* ctx, shim_val_s* val)
+batch_deliver(shim_batch_s* batch)
 {
-#if NODE_VERSION_AT_LEAST(0, 11, 11)
-  ctx->isolate->
-#endif
+  SHIM_PROLOGUE(ctx);
+  SHIM_CTX(ctx);
 
-  ThrowException(val->handle);
-}
+  size_t start = batch->delivered;
+  int status = batch->status;
 
-/**
- * \param ctx Currently executing context
- * \param rval The currently pending exception
- * \return TRUE if there was an exception, otherwise FALSE
- */
-shim_bool_t
-shim_exception_get(shim_ctx_s* ctx, shim_val_s** rval)
-{
-  *rval = new shim_val_s(ctx->trycatch->Exception());
-  return TRUE;
+  batch->delivered = batch->finished;
+  batch->status = 0;
+
+  batch->after_cb(&ctx, batch, status, batch->done + start,
+    batch->delivered - start, batch->hint);
+  if (ctx_trycatch.HasCaught())
+    work_fatal(&ctx, ctx_trycatch);
+  shim_context_cleanup(&ctx);
 }
 
-/**
- * \param ctx Currently executing context
- */
+
+/* the hint of a chunk's job is where its items start */
 void
-shim_exception_clear(shim_ctx_s* ctx)
+batch_work(uv_work_t* req)
 {
-  ctx->trycatch->Reset();
+  shim_work_t* work = container_of(req, shim_work_t, req);
+  shim_batch_s* batch = work->batch;
+  size_t start = static_cast<void**>(work->hint) - batch->items;
+  size_t end = start + batch->chunk < batch->count ? start + batch->chunk
+                                                   : batch->count;
+
+  for (size_t i = start; i < end; i++)
+    batch->work_cb(work, batch->items[i]);
 }
 
-/**
- * \param ctx Currently executing context
- * \param msg The message to set as the pending exception
- * \param ... Arguments for formatting
- */
+
+/* chunks finish here without a scope, only whole deliveries reach javascript */
 void
-shim_throw_error(shim_ctx_s* ctx, const char* msg, ...)
+#if NODE_VERSION_AT_LEAST(0, 10, 0)
+batch_after(uv_work_t* req, int status)
 {
-  va_list ap;
-  va_start(ap, msg);
-#if NODE_VERSION_AT_LEAST(0, 11, 11)
-  ctx->isolate->
+#else
+batch_after(uv_work_t* req)
+{
+  int status = 0;
 #endif
-  ThrowException(shim::shim_format_error(ctx, SHIM_ERR_ERROR, msg, ap));
-  va_end(ap);
+  shim_work_t* work = container_of(req, shim_work_t, req);
+  shim_batch_s* batch = work->batch;
+  size_t start = static_cast<void**>(work->hint) - batch->items;
+  size_t len = batch->count - start < batch->chunk ? batch->count - start
+                                                   : batch->chunk;
+
+  memcpy(batch->done + batch->finished, batch->items + start,
+    len * sizeof(void*));
+  batch->finished += len;
+
+  if (status != 0 && batch->status == 0)
+    batch->status = status;
+
+  work_free(work);
+
+  if (batch->finished - batch->delivered >= batch->granularity
+      || batch->finished == batch->count)
+    batch_deliver(batch);
+
+  if (batch->delivered == batch->count)
+    free(batch);
 }
 
 /**
- * \param ctx Currently executing context
- * \param msg The message to set as the pending exception
- * \param ... Arguments for formatting
+ * \param work_cb Callback that will be called on a different thread
+ * \param after_cb Callback that will be called on the main thread
+ * \param hint Arbitrary data to be passed to both callbacks
+ * \return A handle to the queued job for shim_work_cancel
  */
-void
-shim_throw_type_error(shim_ctx_s* ctx, const char* msg, ...)
+shim_work_handle_t
+shim_queue_work(shim_work_cb work_cb, shim_after_work after_cb, void* hint)
 {
-  va_list ap;
-  va_start(ap, msg);
-#if NODE_VERSION_AT_LEAST(0, 11, 11)
-  ctx->isolate->
-#endif
-  ThrowException(shim::shim_format_error(ctx, SHIM_ERR_TYPE, msg, ap));
-  va_end(ap);
+  return shim_queue_work_flags(work_cb, after_cb, hint, 0);
 }
 
 /**
- * \param ctx Currently executing context
- * \param msg The message to set as the pending exception
- * \param ... Arguments for formatting
+ * \param work_cb Callback that will be called on a different thread
+ * \param after_cb Callback that will be called on the main thread
+ * \param hint Arbitrary data to be passed to both callbacks
+ * \param flags SHIM_WORK_POOL to run on the addon layer's own pool,
+ * SHIM_WORK_COALESCE to have after_cb share a scope with other finished jobs,
+ * SHIM_WORK_PRIORITY_HIGH or SHIM_WORK_PRIORITY_BACKGROUND to pick a lane
+ * \return A handle to the queued job for shim_work_cancel
+ *
+ * Only the addon pool has priority lanes, so either priority flag implies
+ * SHIM_WORK_POOL. Idle workers take high priority jobs from anywhere in the
+ * pool before normal ones, and background jobs only when nothing else waits.
  */
-void
-shim_throw_range_error(shim_ctx_s* ctx, const char* msg, ...)
+shim_work_handle_t
+shim_queue_work_flags(shim_work_cb work_cb, shim_after_work after_cb,
+  void* hint, uint32_t flags)
 {
-  va_list ap;
-  va_start(ap, msg);
-#if NODE_VERSION_AT_LEAST(0, 11, 11)
-  ctx->isolate->
-#endif
-  ThrowException(shim::shim_format_error(ctx, SHIM_ERR_RANGE, msg, ap));
-  va_end(ap);
+  return shim_queue_work_progress(work_cb, NULL, after_cb, hint, flags);
 }
 
 /**
- * \param ctx Currently executing context
- * \param arg Given wrapped value
- * \param type The destination type
- * \param rval The pointer to where the data will be stored
- * \return TRUE if it was able to convert, otherwise FALSE
+ * \param work_cb Callback that will be called on a different thread
+ * \param progress_cb Callback that will be called on the main thread with
+ * progress published by work_cb
+ * \param after_cb Callback that will be called on the main thread
+ * \param hint Arbitrary data to be passed to all callbacks
+ * \param flags The same flags as shim_queue_work_flags
+ * \return A handle to the queued job for shim_work_cancel
+ *
+ * Progress published with shim_work_progress is appended to a buffer and
+ * handed to progress_cb at most once per turn of the loop, so a large
+ * transform can be streamed out in chunks instead of being held until
+ * after_cb. Any progress not yet delivered when the job finishes is passed
+ * to progress_cb right before after_cb.
  */
-shim_bool_t
-shim_unpack_type(shim_ctx_s* ctx, shim_val_s* arg, shim_type_t type,
-  void* rval)
+shim_work_handle_t
+shim_queue_work_progress(shim_work_cb work_cb, shim_progress_cb progress_cb,
+  shim_after_work after_cb, void* hint, uint32_t flags)
 {
-  shim_bool_t allocated = FALSE;
-  shim_bool_t ret = shim::shim_unpack_type(ctx, arg, type, rval, &allocated);
+  shim_work_t* work = work_alloc();
+  shim_work_handle_t handle = work_handle(work);
+  work->work_cb = work_cb;
+  work->after_cb = after_cb;
+  work->hint = hint;
+  work->flags = flags;
+  work->queued = false;
+  work->progress = NULL;
+  work->batch = NULL;
+
+  if (progress_cb != NULL) {
+    shim_progress_s* progress = new shim_progress_s;
+    progress->progress_cb = progress_cb;
+    progress->work = work;
+    progress->data = NULL;
+    progress->len = 0;
+    progress->size = 0;
+    progress->spare = NULL;
+    progress->spare_size = 0;
+    uv_mutex_init(&progress->lock);
+    uv_async_init(uv_default_loop(), &progress->async, progress_async);
+    work->progress = progress;
+  }
+
+#if NODE_VERSION_AT_LEAST(0, 10, 0)
+  if (flags & SHIM_WORK_COALESCE)
+    done_start();
 
-  if (ret == FALSE)
-    if (allocated)
-      shim::shim_value_release(*static_cast<shim_val_s**>(rval));
+  if (work_pooled(flags)) {
+    if (pool_size == 0)
+      shim_pool_start(0, 0);
 
-  return ret;
+    pool_submit(work);
+    return handle;
+  }
+#endif
+
+  uv_queue_work(uv_default_loop(), &work->req, before_work, before_after);
+
+  return handle;
 }
 
 /**
- * \param ctx Currently executing context
- * \param args Arguments passed to the function
- * \param idx Index of the argument to unpack
- * \param type The destination type
- * \param rval The pointer to the destination
- * \return TRUE if it was able to unpack, otherwise FALSE
+ * \param work The job currently running this work callback
+ * \param data The bytes to publish, copied before this returns
+ * \param len The number of bytes
+ *
+ * Only valid from the work callback of a job queued with
+ * shim_queue_work_progress, otherwise the progress is ignored.
  */
-shim_bool_t
-shim_unpack_one(shim_ctx_s* ctx, shim_args_t* args, uint32_t idx,
-  shim_type_t type, void* rval)
+void
+shim_work_progress(shim_work_t* work, const char* data, size_t len)
 {
-  shim_val_s* arg = args->argv[idx];
-  return shim::shim_unpack_type(ctx, arg, type, rval);
+  shim_progress_s* progress = work->progress;
+
+  if (progress == NULL || len == 0)
+    return;
+
+  uv_mutex_lock(&progress->lock);
+
+  if (progress->len + len > progress->size) {
+    size_t size = progress->size == 0 ? 4096 : progress->size;
+
+    while (size < progress->len + len)
+      size *= 2;
+
+    progress->data = static_cast<char*>(realloc(progress->data, size));
+    progress->size = size;
+  }
+
+  memcpy(progress->data + progress->len, data, len);
+  progress->len += len;
+
+  uv_mutex_unlock(&progress->lock);
+
+  uv_async_send(&progress->async);
 }
 
 /**
- * \param ctx Currently executing context
- * \param args Arguments passed to the function
- * \param type The first type to unpack
- * \return TRUE if all desired arguments were able to be unpacked, otherwise
- * FALSE
- *
- * Arguments are passed in pairs of shim_type_t and a pointer to their
- * destination, you end the set of pairs by a single SHIM_TYPE_UNKNOWN.
+ * \param handle The handle returned when the job was queued
+ * \return 0 if the job was cancelled, otherwise -1 if it is already running,
+ * has finished or can't be cancelled on this version of node
  *
- * In the event an argument was unable to be unpacked, FALSE is returned and
- * an exception is set.
+ * A cancelled job never reaches its work_cb, its after_cb is still called on
+ * the main thread with the status libuv uses for cancelled requests so any
+ * hint can be released there. A handle whose job has finished never matches
+ * a later job, even one reusing the same record.
  */
-shim_bool_t
-shim_unpack(shim_ctx_s* ctx, shim_args_t* args, shim_type_t type, ...)
+int
+shim_work_cancel(shim_work_handle_t handle)
 {
-  size_t cur;
-  shim_type_t ctype = type;
-  shim_val_s** allocs = new shim_val_s*[args->argc];
-  size_t alloc_count = 0;
-  shim_bool_t ret = TRUE;
-  va_list ap;
-
-  va_start(ap, type);
+#if NODE_VERSION_AT_LEAST(0, 10, 0)
+  /* a handle that was never issued can still match an unused slot's gen */
+  if (handle.slot >= work_slots_len
+      || work_slots[handle.slot].gen != handle.gen
+      || work_slots[handle.slot].work == NULL)
+    return -1;
 
-  for (cur = 0, ctype = type; ctype != SHIM_TYPE_UNKNOWN && cur < args->argc; cur++)
-  {
-    void* rval = va_arg(ap, void*);
-    shim_bool_t allocated = FALSE;
+  shim_work_s* work = work_slots[handle.slot].work;
 
-    SHIM_DEBUG("SHIM UNPACK argument %lu/%lu of type %s and location %p\n",
-      cur, args->argc, shim_type_str(ctype), rval);
-    if(!shim::shim_unpack_type(ctx, args->argv[cur], ctype, rval, &allocated)) {
-      /* TODO this should use a type string */
-      shim::shim_throw_type_error(ctx, "Argument %d not of type %s", cur,
-        shim_type_str(ctype));
-      ret = FALSE;
-    }
+  if (!work_pooled(work->flags))
+    return uv_cancel(reinterpret_cast<uv_req_t*>(&work->req)) == 0 ? 0 : -1;
 
-    if (allocated)
-      allocs[alloc_count++] = *static_cast<shim_val_s**>(rval);
+  /* a stopped pool has already cancelled everything it held */
+  if (pool_size == 0)
+    return -1;
 
-    if (ret == FALSE)
-      break;
+  shim_worker_s* worker = &pool_workers[work->owner];
+  bool queued;
 
-    ctype = static_cast<shim_type_t>(va_arg(ap, int));
+  uv_mutex_lock(&worker->lock);
+  queued = work->queued;
+  if (queued) {
+    QUEUE_REMOVE(&work->member);
+    work->queued = false;
   }
+  uv_mutex_unlock(&worker->lock);
 
-  va_end(ap);
+  if (!queued)
+    return -1;
 
-  if (ret == FALSE)
-    for (size_t i = 0; i < alloc_count; i++)
-      shim::shim_value_release(allocs[i]);
+  uv_mutex_lock(&pool_lock);
+  pool_queued--;
+  uv_mutex_unlock(&pool_lock);
 
-  delete allocs;
+  /* already counted by pool_submit, so hand it straight to the drain */
+  work->status = SHIM__ECANCELED;
+  QUEUE_INSERT_TAIL(&done_queue, &work->member);
+  uv_async_send(&done_async);
 
-  return ret;
+  return 0;
+#else
+  return -1;
+#endif
 }
 
 /**
- * \param args The arguments passed to the function
- * \return The amount of arguments passed to the function
+ * \param work_cb Callback that will be called on a different thread for each
+ * item
+ * \param after_cb Callback that will be called on the main thread as chunks
+ * of items finish
+ * \param items The items to be passed to work_cb, the array is copied
+ * \param count The number of items
+ * \param granularity How many finished items make a chunk, 0 waits for the
+ * whole batch
+ * \param hint Arbitrary data to be passed to after_cb
+ * \return 0 on success, otherwise -1 if there are no items or the batch
+ * couldn't be allocated, in which case after_cb is never called
+ *
+ * Each chunk is a single threadpool job that runs work_cb over its items in
+ * turn, so the loop is only woken and after_cb only called once per chunk,
+ * with the items of that chunk. When the whole batch is waited for it is
+ * still split into SHIM_BATCH_SPLIT jobs to keep the threadpool busy, and
+ * after_cb is called once all of them finish. The status passed is the
+ * first failure seen in the chunk, or 0.
  */
-size_t
-shim_args_length(shim_args_t* args)
+int
+shim_queue_work_batch(shim_work_cb work_cb, shim_after_batch after_cb,
+  void** items, size_t count, size_t granularity, void* hint)
 {
-  return args->argc;
+  if (count == 0)
+    return -1;
+
+  shim_batch_s* batch = static_cast<shim_batch_s*>(
+    malloc(offset_of(shim_batch_s, done) + sizeof(void*) * count * 2));
+
+  if (batch == NULL)
+    return -1;
+
+  batch->work_cb = work_cb;
+  batch->after_cb = after_cb;
+  batch->hint = hint;
+  batch->count = count;
+  batch->granularity = granularity == 0 ? count : granularity;
+  batch->chunk = granularity != 0 ? granularity
+    : (count + SHIM_BATCH_SPLIT - 1) / SHIM_BATCH_SPLIT;
+  batch->finished = 0;
+  batch->delivered = 0;
+  batch->status = 0;
+  batch->items = batch->done + count;
+
+  memcpy(batch->items, items, sizeof(void*) * count);
+
+  for (size_t i = 0; i < count; i += batch->chunk) {
+    shim_work_t* work = shim::work_alloc();
+    work->work_cb = work_cb;
+    work->after_cb = NULL;
+    work->hint = &batch->items[i];
+    work->flags = 0;
+    work->slot = SHIM_WORK_NO_SLOT;
+    work->progress = NULL;
+    work->batch = batch;
+    uv_queue_work(uv_default_loop(), &work->req, batch_work, batch_after);
+  }
+
+  return 0;
 }
 
 /**
- * \param args The arguments passed to the function
- * \param idx The index of the desired argument
- * \return The wrapped argument
+ * \param max The most idle work records to keep around
+ *
+ * Finished jobs hand their record back to a pool instead of freeing it, this
+ * sets how large that pool may grow. Records over the new limit are freed.
  */
-shim_val_s*
-shim_args_get(shim_args_t* args, size_t idx)
+void
+shim_work_pool_max(size_t max)
 {
-  /* TODO assert */
-  return args->argv[idx];
+  work_pool_limit = max;
+
+  while (work_pool_len > work_pool_limit) {
+    shim_work_s* work = work_pool;
+    work_pool = work->next;
+    work_pool_len--;
+    delete work;
+  }
 }
 
 /**
- * \param ctx Currently executing context
- * \param args The arguments passed to the function
- * \param val The value to use for return
- * \return TRUE if it was able to set the return value, otherwise FALSE
+ * \param max The most finished jobs to deliver per turn of the loop, 0 for
+ * no limit
+ *
+ * Jobs on the addon pool and jobs queued with SHIM_WORK_COALESCE are drained
+ * in bulk, this bounds how long one drain may hold up the loop. Whatever is
+ * left over is picked up on the next turn.
  */
-shim_bool_t
-shim_args_set_rval(shim_ctx_s* ctx, shim_args_t* args, shim_val_s* val)
+void
+shim_work_drain_max(size_t max)
 {
-  /* TODO check if persistent */
-  /*
-  if (!shim_has_allocd(ctx, val))
-    allocs_from_ctx(ctx)->insert(val);
-  */
-  args->ret = val;
-  return TRUE;
+#if NODE_VERSION_AT_LEAST(0, 10, 0)
+  done_max = max == 0 ? static_cast<size_t>(-1) : max;
+#endif
 }
 
 /**
- * \param ctx Currently executing context
- * \param args The arguments passed to the function
- * \return The `this` associated with the executing function
+ * \param stats Where to store the current counters
  */
-shim_val_s*
-shim_args_get_this(shim_ctx_s* ctx, shim_args_t* args)
+void
+shim_work_pool_stats(shim_work_stats_t* stats)
 {
-  return args->self;
+  stats->hits = work_pool_hits;
+  stats->misses = work_pool_misses;
+  stats->idle = work_pool_len;
+  stats->max = work_pool_limit;
 }
 
-/**
- * \param ctx Currently executing context
- * \param args The arguments passed to the function
- * \return Pointer to the arbitrary data associated with the executing function
- */
-void*
-shim_args_get_data(shim_ctx_s* ctx, shim_args_t* args)
+
+#if NODE_VERSION_AT_LEAST(0, 10, 0)
+void
+channel_free(shim_channel_s* channel)
 {
-  return args->data;
+  uv_mutex_destroy(&channel->lock);
+  uv_cond_destroy(&channel->cond);
+  free(channel->ring);
+  free(channel->drain);
+  delete channel;
 }
 
 
+/* whoever is last out of the channel, this or a sender, frees it */
 void
-before_work(uv_work_t* req)
+channel_closed(uv_handle_t* handle)
 {
-  shim_work_t* work = static_cast<shim_work_t*>(req->data);
-  work->work_cb(work, work->hint);
+  shim_channel_s* channel = container_of(handle, shim_channel_s, async);
+  bool last;
+
+  uv_mutex_lock(&channel->lock);
+  channel->released = true;
+  last = channel->senders == 0;
+  uv_mutex_unlock(&channel->lock);
+
+  if (last)
+    channel_free(channel);
 }
 
 
+/* everything sent since the last turn reaches javascript as one array */
 void
+#if NODE_VERSION_AT_LEAST(0, 11, 13)
+channel_drain(uv_async_t* handle)
+#else
+channel_drain(uv_async_t* handle, int status)
+#endif
+{
+  shim_channel_s* channel = container_of(handle, shim_channel_s, async);
+  size_t count;
+  bool closed;
+
+  uv_mutex_lock(&channel->lock);
+
+  count = channel->len;
+  for (size_t i = 0; i < count; i++)
+    channel->drain[i] = channel->ring[(channel->head + i) % channel->capacity];
+
+  channel->head = 0;
+  channel->len = 0;
+  closed = channel->closed;
+
+  uv_cond_broadcast(&channel->cond);
+  uv_mutex_unlock(&channel->lock);
+
+  if (count > 0) {
+    SHIM_PROLOGUE(ctx);
+    SHIM_CTX(ctx);
+
+    shim_val_s* fn;
+    shim_val_s* arr = shim_array_new(&ctx, count);
+
+    for (size_t i = 0; i < count; i++) {
+      void* payload = channel->drain[i];
+      shim_val_s* val = channel->convert != NULL
+        ? channel->convert(&ctx, channel, payload, channel->hint)
+        : shim_external_new(&ctx, payload);
+      shim_array_set(&ctx, arr, i, val != NULL ? val : shim_undefined());
+    }
+
+    shim_persistent_to_val(&ctx, channel->fn, &fn);
+    shim_make_callback_val(&ctx, NULL, fn, 1, &arr, NULL);
+    shim_context_cleanup(&ctx);
+  }
+
+  /* senders never signal the handle once they've seen closed */
+  if (closed) {
+    shim_persistent_dispose(channel->fn);
+    uv_close(reinterpret_cast<uv_handle_t*>(&channel->async), channel_closed);
+  }
+}
+#endif
+
+/**
+ * \param ctx Currently executing context
+ * \param fn The function called on the main thread with an array of payloads
+ * \param capacity The most payloads waiting to be delivered at once
+ * \param policy SHIM_CHANNEL_BLOCK or SHIM_CHANNEL_DROP for when it is full
+ * \param convert Callback to turn each payload into a value, NULL passes
+ * payloads as externals, a payload it returns NULL for is passed as undefined
+ * \param hint Arbitrary data to be passed to convert
+ * \return The channel, or NULL if unsupported on this version of node
+ *
+ * Native producers that emit many results per job send each payload through
+ * the channel from whichever thread they run on. Whatever arrives before the
+ * loop thread gets to it is converted and handed to fn in a single call. The
+ * channel keeps the event loop alive until it is closed.
+ */
+shim_channel_t*
+shim_channel_new(shim_ctx_t* ctx, shim_val_t* fn, size_t capacity,
+  int policy, shim_channel_convert convert, void* hint)
+{
 #if NODE_VERSION_AT_LEAST(0, 10, 0)
-before_after(uv_work_t* req, int status)
+  if (capacity == 0)
+    capacity = 1;
+
+  shim_channel_s* channel = new shim_channel_s;
+  channel->fn = shim_persistent_new(ctx, fn);
+  channel->convert = convert;
+  channel->hint = hint;
+  channel->policy = policy;
+  channel->closed = false;
+  channel->released = false;
+  channel->senders = 0;
+  channel->capacity = capacity;
+  channel->head = 0;
+  channel->len = 0;
+  channel->ring = static_cast<void**>(malloc(capacity * sizeof(void*)));
+  channel->drain = static_cast<void**>(malloc(capacity * sizeof(void*)));
+
+  uv_mutex_init(&channel->lock);
+  uv_cond_init(&channel->cond);
+  uv_async_init(uv_default_loop(), &channel->async, channel_drain);
+
+  return channel;
+#else
+  return NULL;
+#endif
+}
+
+/**
+ * \param channel The channel
+ * \param payload Arbitrary data to be passed to convert on the main thread
+ * \return SHIM_CHANNEL_OK when queued, otherwise SHIM_CHANNEL_FULL or
+ * SHIM_CHANNEL_CLOSED and the payload still belongs to the caller
+ *
+ * With SHIM_CHANNEL_BLOCK a full channel makes the caller wait until the
+ * main thread drains it, so that policy must not be used to send from the
+ * main thread itself.
+ *
+ * Sends already under way when the channel is closed are safe and return
+ * SHIM_CHANNEL_CLOSED, but the channel may be freed any time after that, so
+ * no send may start once shim_channel_close has been called.
+ */
+int
+shim_channel_send(shim_channel_t* channel, void* payload)
 {
+#if NODE_VERSION_AT_LEAST(0, 10, 0)
+  int ret = SHIM_CHANNEL_OK;
+  bool last;
+
+  uv_mutex_lock(&channel->lock);
+  channel->senders++;
+
+  while (!channel->closed && channel->len == channel->capacity
+         && channel->policy == SHIM_CHANNEL_BLOCK)
+    uv_cond_wait(&channel->cond, &channel->lock);
+
+  if (channel->closed) {
+    ret = SHIM_CHANNEL_CLOSED;
+  } else if (channel->len == channel->capacity) {
+    ret = SHIM_CHANNEL_FULL;
+  } else {
+    size_t tail = (channel->head + channel->len++) % channel->capacity;
+    channel->ring[tail] = payload;
+    /* under the lock so the drain can't release the handle out from under us */
+    uv_async_send(&channel->async);
+  }
+
+  channel->senders--;
+  last = channel->released && channel->senders == 0;
+  uv_mutex_unlock(&channel->lock);
+
+  if (last)
+    channel_free(channel);
+
+  return ret;
 #else
-before_after(uv_work_t* req)
+  return SHIM_CHANNEL_CLOSED;
+#endif
+}
+
+/**
+ * \param channel The channel
+ *
+ * Safe to call from any thread, once every producer is done starting sends.
+ * Payloads already queued are still delivered, then the function is
+ * released and the channel freed once the last sender still waiting on a
+ * full channel returns SHIM_CHANNEL_CLOSED.
+ */
+void
+shim_channel_close(shim_channel_t* channel)
 {
-  int status = 0;
+#if NODE_VERSION_AT_LEAST(0, 10, 0)
+  uv_mutex_lock(&channel->lock);
+
+  if (!channel->closed) {
+    channel->closed = true;
+    uv_cond_broadcast(&channel->cond);
+    uv_async_send(&channel->async);
+  }
+
+  uv_mutex_unlock(&channel->lock);
 #endif
-  SHIM_PROLOGUE(ctx);
-  SHIM_CTX(ctx);
-  shim_work_t* work = static_cast<shim_work_t*>(req->data);
-  work->after_cb(&ctx, work, status, work->hint);
-  shim_context_cleanup(&ctx);
-  delete work;
-  delete req;
 }
 
 /**
- * \param work_cb Callback that will be called on a different thread
- * \param after_cb Callback that will be called on the main thread
- * \param hint Arbitrary data to be passed to both callbacks
+ * \param enabled Whether boundary calls should be traced
+ *
+ * Tracing writes the name of every C function entered and left through the
+ * addon layer to stderr. It can also be enabled by starting node with
+ * `SHIM_TRACE=1` in the environment.
  */
 void
-shim_queue_work(shim_work_cb work_cb, shim_after_work after_cb, void* hint)
+shim_trace_enable(shim_bool_t enabled)
 {
-  uv_work_t* req = new uv_work_t;
-  shim_work_t* work = new shim_work_t;
-  work->work_cb = work_cb;
-  work->after_cb = after_cb;
-  work->hint = hint;
-  req->data = work;
-  uv_queue_work(uv_default_loop(), req, before_work, before_after);
+  shim_tracing = enabled;
 }
 
 /**
@@ -2052,6 +5409,8 @@ shim_type_str(shim_type_t type)
     SHIM_ITEM(SHIM_TYPE_FUNCTION)
     SHIM_ITEM(SHIM_TYPE_STRING)
     SHIM_ITEM(SHIM_TYPE_BUFFER)
+    SHIM_ITEM(SHIM_TYPE_ARRAY_BUFFER)
+    SHIM_ITEM(SHIM_TYPE_TYPED_ARRAY)
 #undef SHIM_ITEM
   }
 